@@ -6,94 +6,573 @@
 #include <fstream>
 #include <filesystem>
 #include <string>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <system_error>
+#include <charconv>
 
 #include "uomap.hpp"
 #include "strutil.hpp"
+#include "parallel.hpp"
+#include "listwriter.hpp"
+#include "buildfile.hpp"
+#include "manifest.hpp"
+#include "mapdelta.hpp"
+#include "radarmap.hpp"
+#include "benchmark.hpp"
+#include "phasestats.hpp"
+#include "procinfo.hpp"
 
 using namespace std::string_literals;
 
+//=================================================================================
+// Messages from the map workers are written a full line at a time, and
+// tagged with the map, so the output stays readable when maps run in parallel
+//=================================================================================
+static auto reportlock = std::mutex() ;
+//=================================================================================
+auto report(std::ostream &output, int mapnum, const std::string &msg) ->void {
+	auto line = strutil::format("map %i: %s\n",mapnum,msg.c_str()) ;
+	auto lock = std::lock_guard<std::mutex>(reportlock);
+	output << line << std::flush ;
+}
+
+//=================================================================================
+// Limits how many map blocks (and so how much memory) are resident at once.
+// A map waits until its blocks fit in the budget, unless nothing else is
+// resident (so a map larger than the budget still runs, just on its own).
+//=================================================================================
+class residentgate_t {
+	std::mutex lock ;
+	std::condition_variable changed ;
+	std::uint64_t budget ;
+	std::uint64_t used ;
+public:
+	residentgate_t(std::uint64_t budget) :budget(budget),used(0){}
+	auto acquire(std::uint64_t blocks) ->void {
+		auto guard = std::unique_lock<std::mutex>(lock);
+		changed.wait(guard,[this,blocks](){return (used == 0) || (used + blocks <= budget);});
+		used += blocks ;
+	}
+	auto release(std::uint64_t blocks) ->void {
+		{
+			auto guard = std::lock_guard<std::mutex>(lock);
+			used -= blocks ;
+		}
+		changed.notify_all();
+	}
+};
+
+//=================================================================================
+// What to generate for each map
+//=================================================================================
+struct options_t {
+	bool binary = false ;		// Also write buildmap%i.bin (see buildfile.hpp)
+	bool incremental = false ;	// Only redo the sections that changed since the last run (see manifest.hpp)
+	std::filesystem::path previous ;	// If set, write deltamap%i.lst against the client here (see mapdelta.hpp)
+	bool verify = false ;		// Check the uop data hashes on load
+	std::filesystem::path radar ;	// If set, write the overview image tiles here (see radarmap.hpp)
+	std::filesystem::path output ;	// Where the lists (and manifests) go, the current directory if empty
+	unsigned int threads = 0 ;	// Threads the work of one map may use (0 = one per hardware thread)
+};
+
+//=================================================================================
+// The number of segments (see manifest.hpp) in the command list of a map
+//=================================================================================
+auto segmentCount(int width, int height) ->std::size_t {
+	auto blocksacross = width/8 ;
+	auto blocksdown = height/8 ;
+	auto count = std::size_t(0) ;
+	for (auto blocky = 0 ; blocky < blocksdown ; ++blocky){
+		for (auto blockx = 0 ; blockx < blocksacross ; ++blockx){
+			auto block = blockx*blocksdown + blocky ;
+			if ((blockx == 0) || ((block/uomap_t::sectionblocks) != ((block - blocksdown)/uomap_t::sectionblocks))){
+				++count ;
+			}
+		}
+	}
+	return count * 8 ;
+}
+
+//=================================================================================
+// The overview image pyramid of a map, coloured from the client's radarcol.mul
+//=================================================================================
+auto radarMap(const std::filesystem::path &basedir, int mapnum, const options_t &options, const uomap_t &uomap) ->bool {
+	auto colors = basedir / std::filesystem::path("radarcol.mul");
+	auto radar = radarmap_t() ;
+	if (!radar.loadColors(colors.string())){
+		report(std::cerr,mapnum,"Unable to load radar colours from: "s + colors.string());
+		return false ;
+	}
+	auto error = std::error_code() ;
+	std::filesystem::create_directories(options.radar, error);
+	radar.render(uomap, 256, options.threads);
+	auto levels = 0 ;
+	if (!radar.write(options.radar.string(), strutil::format("radar%i",mapnum), 256, options.threads, &levels)){
+		report(std::cerr,mapnum,"Error writing radar tiles to: "s + options.radar.string());
+		return false ;
+	}
+	report(std::cout,mapnum,strutil::format("Radar written, %i levels",levels));
+	return true ;
+}
+
+//=================================================================================
+auto extractMap(const std::filesystem::path &basedir, int mapnum, const options_t &options, phasestats_t *stats = nullptr) ->bool {
+	auto width = 0 ;
+	auto height = 0 ;
+	auto sourcemap = basedir / std::filesystem::path(strutil::format("map%iLegacyMUL.uop",mapnum));
+	auto artidx = basedir / std::filesystem::path(strutil::format("staidx%i.mul",mapnum));
+	auto artmul = basedir / std::filesystem::path(strutil::format("statics%i.mul",mapnum));
+	auto difl =basedir / std::filesystem::path(strutil::format("stadifl%i.mul",mapnum));
+	auto difi =basedir / std::filesystem::path(strutil::format("stadifi%i.mul",mapnum));
+	auto dif =basedir / std::filesystem::path(strutil::format("stadif%i.mul",mapnum));
+
+	auto commandlist = (options.output / strutil::format("buildmap%i.lst",mapnum)).string();
+	auto binarylist = (options.output / strutil::format("buildmap%i.bin",mapnum)).string();
+	auto manifestfile = (options.output / strutil::format("buildmap%i.manifest",mapnum)).string();
+
+
+	auto uomap = uomap_t(mapnum,width,height) ;
+	auto [twidth,theight] = uomap.size() ;
+	width = twidth ;
+	height = theight ;
+	uomap.stats(stats);
+	uomap.jobs(options.threads);
+
+	// What the last run saw, if it is of use.  If no source has changed since,
+	// there is nothing to do.
+	auto current = manifest_t() ;
+	auto previous = manifest_t() ;
+	auto haveprevious = false ;
+	if (options.incremental){
+		current.mapnumber = mapnum ;
+		current.width = width ;
+		current.height = height ;
+		for (const auto &path : {sourcemap,artidx,artmul,difl,difi,dif}){
+			current.sources.push_back(manifest_t::fingerprint(path));
+		}
+		haveprevious = previous.load(manifestfile) && (previous.mapnumber == mapnum) && (previous.width == width) && (previous.height == height) ;
+		haveprevious = haveprevious && (previous.terrainhashes.size() == uomap.sectionCount()) && (previous.segments.size() == segmentCount(width, height)) ;
+		haveprevious = haveprevious && std::filesystem::exists(commandlist) && (!options.binary || std::filesystem::exists(binarylist)) ;
+		// and the lists are still the ones it was saved with
+		haveprevious = haveprevious && (previous.list == manifest_t::fingerprint(commandlist)) && (!options.binary || (previous.binary == manifest_t::fingerprint(binarylist))) ;
+		if (haveprevious && (previous.sources == current.sources)){
+			report(std::cout,mapnum,"Unchanged since the last run, skipping");
+			return true ;
+		}
+		// Only the sections that changed are read in
+		uomap.lazy(true);
+	}
+	else {
+		// This run rewrites the lists, so a manifest from before no longer
+		// describes them
+		auto error = std::error_code() ;
+		std::filesystem::remove(manifestfile, error);
+	}
+	uomap.verify(options.verify);
+	if (!uomap.loadTerrainUOP(sourcemap.string())) {
+		report(std::cerr,mapnum,"Unable to load terrain, skipping");
+		return false ;
+	}
+	if (!uomap.loadArt(artidx.string(), artmul.string())){
+		report(std::cerr,mapnum,"Unable to load art, skipping");
+		return false ;
+	}
+	report(std::cout,mapnum,"Generating map");
+	// An incremental run reads the last list as it goes, so the new one is
+	// written beside it, and replaces it at the end
+	auto outputfile = options.incremental ? commandlist + ".tmp"s : commandlist ;
+	auto output = listwriter_t(outputfile) ;
+	if (!output.is_open()){
+		report(std::cerr,mapnum,"Unable to create: "s + outputfile);
+		return false ;
+	}
+	output << "//Generation of map " << mapnum << '\n';
+	output << "//Terrain from: "<<sourcemap.string() << '\n';
+	output <<"//" << '\n';
+	output << "//Art from: "<<artidx.string() << '\n';
+	output << "//Art from: "<<artmul.string() << '\n';
+	output <<"//" << '\n';
+	output <<"//Art diff from: " << difl.string() << '\n';
+	output <<"//Art diff from: " << difi.string() << '\n';
+	output <<"//Art diff from: " << dif.string() << '\n';
+
+
+	if (!uomap.applyArtDiff(difl.string(), difi.string(), dif.string())) {
+		report(std::cerr,mapnum,"Unable to load art diffs, continuing without");
+	}
+	output <<"//" << '\n';
+	output <<"init "<<mapnum<<","<<width<<","<<height << '\n';
+
+	output <<"msg Populating map" << '\n';
+
+	// Which sections have to be generated again
+	auto dirty = std::vector<bool>(uomap.sectionCount(),true) ;
+	auto lastlist = std::ifstream() ;
+	if (options.incremental){
+		for (std::size_t section = 0 ; section < dirty.size() ; ++section){
+			current.terrainhashes.push_back(uomap.terrainHash(section));
+			current.arthashes.push_back(uomap.artHash(section));
+		}
+		if (haveprevious){
+			lastlist.open(commandlist);
+			haveprevious = lastlist.is_open() ;
+		}
+		if (haveprevious){
+			for (std::size_t section = 0 ; section < dirty.size() ; ++section){
+				dirty[section] = (current.terrainhashes[section] != previous.terrainhashes[section]) || (current.arthashes[section] != previous.arthashes[section]) ;
+			}
+			lastlist.ignore(static_cast<std::streamsize>(previous.preamble));
+			auto changed = std::count(dirty.begin(),dirty.end(),true) ;
+			report(std::cout,mapnum,strutil::format("%i of %i sections changed",static_cast<int>(changed),static_cast<int>(dirty.size())));
+		}
+	}
+
+	// Each segment is either copied from the last list, or generated
+	auto copied = true ;
+	auto segment = std::size_t(0) ;
+	auto segmentstart = output.written() ;
+	current.preamble = segmentstart ;
+	auto startSegment = [&](int, std::size_t section){
+		if (!options.incremental){
+			return ;
+		}
+		auto now = output.written() ;
+		if (segment > 0){
+			current.segments.push_back(static_cast<std::uint32_t>(now - segmentstart));
+		}
+		segmentstart = now ;
+		if (haveprevious){
+			auto length = previous.segments[segment] ;
+			if (dirty[section]){
+				lastlist.ignore(static_cast<std::streamsize>(length));
+			}
+			else {
+				copied = output.copy(lastlist, length) && copied ;
+			}
+		}
+		++segment ;
+	};
+	auto wanted = [&dirty](std::size_t section){
+		return dirty[section] ;
+	};
+	auto phase = phasestats_t::scope_t(stats, "emitList") ;
+	auto &counters = phase.counters() ;
+	uomap.forEachTileByRow([&output, &counters](int x, int y, std::uint16_t terid, std::int8_t teralt, const artrecord_t *first, const artrecord_t *last){
+		if ((x == 0) && (y%8 ==0)) {
+			output <<"//" << '\n';
+			output<<"// Starting section y="<<y<<'\n';
+			output <<"msg Starting section y = " <<y<<'\n';
+			output <<"//" << '\n';
+		}
+		if ((x%8 == 0) && (y%8 == 0)){
+			++counters.blocks ;
+		}
+		counters.records += static_cast<std::uint64_t>(last - first) ;
+		output<<"add terrain,"<<x<<','<<y<<',' ;
+		output.hex(terid,4)<<','<<static_cast<int>(teralt)<<'\n';
+		for (const auto *cell = first ; cell != last ; ++cell){
+			output<<"add art,"<<x<<','<<y<<',' ;
+			output.hex(cell->tileid,4)<<','<<static_cast<int>(cell->altitude)<<','<<cell->hue<<'\n';
+		}
+	}, wanted, startSegment);
+	if (options.incremental){
+		current.segments.push_back(static_cast<std::uint32_t>(output.written() - segmentstart));
+	}
+	lastlist.close();
+	auto closed = output.close() ;
+	counters.byteswritten += output.written() ;
+	phase.end();
+	if (!closed || !copied){
+		report(std::cerr,mapnum,"Error writing: "s + commandlist);
+		if (options.incremental){
+			// The next run starts over
+			std::filesystem::remove(outputfile);
+			std::filesystem::remove(manifestfile);
+		}
+		return false ;
+	}
+	if (options.incremental){
+		auto error = std::error_code() ;
+		std::filesystem::rename(outputfile, commandlist, error);
+		if (error){
+			report(std::cerr,mapnum,"Unable to replace: "s + commandlist);
+			std::filesystem::remove(manifestfile);
+			return false ;
+		}
+	}
+	if (options.binary) {
+		if (!buildfile_t::write(uomap, binarylist)){
+			report(std::cerr,mapnum,"Error writing: "s + binarylist);
+			return false ;
+		}
+	}
+	// The manifest doesn't cover the tiles, so one from before goes, or the
+	// next run would skip the map without writing them
+	if (!options.radar.empty() && !radarMap(basedir, mapnum, options, uomap)){
+		auto error = std::error_code() ;
+		std::filesystem::remove(manifestfile, error);
+		return false ;
+	}
+	if (options.incremental){
+		current.list = manifest_t::fingerprint(commandlist) ;
+		if (options.binary){
+			current.binary = manifest_t::fingerprint(binarylist) ;
+		}
+	}
+	if (options.incremental && !current.save(manifestfile)){
+		report(std::cerr,mapnum,"Error writing: "s + manifestfile);
+		std::filesystem::remove(manifestfile);
+	}
+	return true ;
+}
+
+//=================================================================================
+// Terrain, statics and statics diffs of a map
+//=================================================================================
+auto loadMap(const std::filesystem::path &basedir, int mapnum, const options_t &options, uomap_t &uomap, phasestats_t *stats) ->bool {
+	auto sourcemap = basedir / std::filesystem::path(strutil::format("map%iLegacyMUL.uop",mapnum));
+	auto artidx = basedir / std::filesystem::path(strutil::format("staidx%i.mul",mapnum));
+	auto artmul = basedir / std::filesystem::path(strutil::format("statics%i.mul",mapnum));
+	auto difl =basedir / std::filesystem::path(strutil::format("stadifl%i.mul",mapnum));
+	auto difi =basedir / std::filesystem::path(strutil::format("stadifi%i.mul",mapnum));
+	auto dif =basedir / std::filesystem::path(strutil::format("stadif%i.mul",mapnum));
+	uomap.verify(options.verify);
+	uomap.stats(stats);
+	uomap.jobs(options.threads);
+	if (!uomap.loadTerrainUOP(sourcemap.string())) {
+		report(std::cerr,mapnum,"Unable to load terrain from: "s + sourcemap.string());
+		return false ;
+	}
+	if (!uomap.loadArt(artidx.string(), artmul.string())){
+		report(std::cerr,mapnum,"Unable to load art from: "s + artmul.string());
+		return false ;
+	}
+	if (!uomap.applyArtDiff(difl.string(), difi.string(), dif.string())) {
+		report(std::cerr,mapnum,"Unable to load art diffs from: "s + basedir.string() + ", continuing without"s);
+	}
+	return true ;
+}
+
+//=================================================================================
+// Only what changed between the client in options.previous and the one in basedir
+//=================================================================================
+auto deltaMap(const std::filesystem::path &basedir, int mapnum, const options_t &options, phasestats_t *stats = nullptr) ->bool {
+	auto deltalist = (options.output / strutil::format("deltamap%i.lst",mapnum)).string();
+	auto before = uomap_t(mapnum) ;
+	auto after = uomap_t(mapnum) ;
+	if (!loadMap(options.previous, mapnum, options, before, stats) || !loadMap(basedir, mapnum, options, after, stats)){
+		report(std::cerr,mapnum,"Unable to load both versions, skipping");
+		return false ;
+	}
+	report(std::cout,mapnum,"Comparing map");
+	auto changes = mapdelta_t::stats_t() ;
+	{
+		auto phase = phasestats_t::scope_t(stats, "emitDelta") ;
+		if (!mapdelta_t::write(before, after, deltalist, &changes)){
+			report(std::cerr,mapnum,"Error writing: "s + deltalist);
+			return false ;
+		}
+		phase.counters().blocks += changes.blocks ;
+		auto error = std::error_code() ;
+		auto size = std::filesystem::file_size(deltalist, error) ;
+		phase.counters().byteswritten += error ? 0 : static_cast<std::uint64_t>(size) ;
+	}
+	report(std::cout,mapnum,strutil::format("%llu blocks changed (%llu terrain, %llu statics tiles)",static_cast<unsigned long long>(changes.blocks),static_cast<unsigned long long>(changes.terrain),static_cast<unsigned long long>(changes.art)));
+	return true ;
+}
+
+//=================================================================================
+// The whole of text as a number, false if it isn't one (or doesn't fit)
+//=================================================================================
+template <typename T>
+auto parseNumber(const std::string &text, T &value) ->bool {
+	const auto *last = text.data() + text.size() ;
+	auto [end,error] = std::from_chars(text.data(), last, value) ;
+	return !text.empty() && (error == std::errc()) && (end == last) ;
+}
+
+//=================================================================================
+// The phases of every map, as one JSON object (to the console for "-")
+//=================================================================================
+auto writeStats(const std::string &filepath, const std::vector<phasestats_t> &mapstats) ->bool {
+	auto json = strutil::format("{\"peakResident\":%llu,\"maps\":[",static_cast<unsigned long long>(procinfo::peakResident())) ;
+	auto first = true ;
+	for (std::size_t mapnum = 0 ; mapnum < mapstats.size() ; ++mapnum){
+		if (!mapstats[mapnum].phases().empty()){
+			json += (first ? ""s : ","s) + mapstats[mapnum].json(static_cast<int>(mapnum)) ;
+			first = false ;
+		}
+	}
+	json += "]}\n" ;
+	if (filepath == "-"){
+		auto lock = std::lock_guard<std::mutex>(reportlock);
+		std::cout << json << std::flush ;
+		return true ;
+	}
+	auto output = std::ofstream(filepath) ;
+	if (!output.is_open()){
+		return false ;
+	}
+	output << json ;
+	return output.good() ;
+}
+
+//=================================================================================
 int main(int argc, const char * argv[]) {
 #if defined (_WIN32)
 	auto basedir = std::filesystem::path("C:\\Program Files (x86)\\Electronic Arts\\Ultima Online Classic");
 #else
 	auto basedir = std::filesystem::path("/Users/charleskerr/Documents/uoclient");
 #endif
-	if (argc >1) {
-		basedir = std::filesystem::path(argv[1]);
-	}
-	
-	for (auto mapnum = 0 ; mapnum < 6 ; ++mapnum){
-		auto width = 0 ;
-		auto height = 0 ;
-		auto sourcemap = basedir / std::filesystem::path(strutil::format("map%iLegacyMUL.uop",mapnum));
-		auto artidx = basedir / std::filesystem::path(strutil::format("staidx%i.mul",mapnum));
-		auto artmul = basedir / std::filesystem::path(strutil::format("statics%i.mul",mapnum));
-		auto difl =basedir / std::filesystem::path(strutil::format("stadifl%i.mul",mapnum));
-		auto difi =basedir / std::filesystem::path(strutil::format("stadifi%i.mul",mapnum));
-		auto dif =basedir / std::filesystem::path(strutil::format("stadif%i.mul",mapnum));
-		
-		auto commandlist = strutil::format("buildmap%i.lst",mapnum);
-		
-		
-		auto uomap = uomap_t(mapnum,width,height) ;
-		auto [twidth,theight] = uomap.size() ;
-		width = twidth ;
-		height = theight ;
-		if (uomap.loadTerrainUOP(sourcemap.string())) {
-			if (uomap.loadArt(artidx.string(), artmul.string())){
-				
-				std::cout <<"Generating map " << mapnum << std::endl;
-				auto output = std::ofstream(commandlist) ;
-				if (!output.is_open()){
-					std::cerr << "Unable to create: "<<commandlist<<std::endl;
-					break ;
-				}
-				output << "//Generation of map " << mapnum << std::endl;
-				output << "//Terrain from: "<<sourcemap.string() << std::endl;
-				output <<"//" << std::endl;
-				output << "//Art from: "<<artidx.string() << std::endl;
-				output << "//Art from: "<<artmul.string() << std::endl;
-				output <<"//" << std::endl;
-				output <<"//Art diff from: " << difl.string() << std::endl;
-				output <<"//Art diff from: " << difi.string() << std::endl;
-				output <<"//Art diff from: " << dif.string() << std::endl;
-				
-				
-				if (!uomap.applyArtDiff(difl.string(), difi.string(), dif.string())) {
-					std::cerr <<"Unable to load art diffs, continuing without"<<std::endl;
-				}
-				output <<"//" << std::endl;
-				output <<"init "<<mapnum<<","<<width<<","<<height << std::endl;
-				
-				output <<"msg Populating map" << std::endl;
-				for (auto y = 0 ; y<height ;++y){
-					if (y%8 ==0) {
-						//std::cout <<y <<" of "<<height<<std::endl;
-						output <<"//" << std::endl;
-						output<<"// Starting section y="<<y<<std::endl;
-						output <<"msg Starting section y = " <<y<<std::endl;
-						output <<"//" << std::endl;
-					}
-					for (auto x = 0 ; x<width;++x) {
-						auto [terid,teralt] = uomap.terrain(x, y);
-						output<<"add terrain,"<<x<<","<<y<<","<<strutil::ntos(terid,strutil::radix_t::hex,true,4)<<","<<static_cast<int>(teralt)<<std::endl;
-						auto cells = uomap.art(x,y) ;
-						for (auto cell: cells){
-							auto tileid = strutil::ntos(std::get<0>(cell),strutil::radix_t::hex,true,4) ;
-							auto alt = static_cast<int>(std::get<1>(cell));
-							auto hue = std::get<2>(cell) ;
-							output<<"add art,"<<x<<","<<y<<","<<tileid<<","<<alt<<","<<hue<<std::endl;
-						}
-					}
-				}
+	// Usage: UOMapExtractor [--jobs N] [--resident N] [--binary] [--incremental] [--delta previousdir] [--verify] [--radar dir] [--stats file] [clientdir]
+	//        UOMapExtractor --benchmark dir [--density N]
+	//   --jobs N      extract up to N maps at once (0 = one per hardware thread)
+	//   --resident N  at most N full size (7168x4096) maps worth of blocks in memory
+	//   --binary      also write buildmap%i.bin, the binary form of the list
+	//   --incremental only generate again the parts of a map that changed since
+	//                 the last --incremental run (kept in buildmap%i.manifest)
+	//   --delta dir   instead of the full lists, write deltamap%i.lst, the commands
+	//                 that take the maps of the client in dir to those in clientdir
+	//   --verify      check the uop data against its stored hashes, a map that fails
+	//                 is skipped
+	//   --radar dir   also write the overview image of each map to dir, as a
+	//                 pyramid of PPM tiles (radar%i_level_column_row.ppm)
+	//   --stats file  write the time, I/O and peak memory of each phase of each
+	//                 map to file as JSON (- for the console), and the allocations
+	//                 of the whole process during it in a UOMAP_COUNT_ALLOCATIONS
+	//                 build
+	//   --benchmark dir  instead, make up a client for each map in dir, and time
+	//                 the extractor's work on it (see benchmark.hpp)
+	//   --density N   statics per 100 land tiles of the made up maps (25)
+	// Exits with 1 if any map failed (or the arguments are wrong), 0 otherwise
+	auto options = options_t() ;
+	auto jobs = 1u ;
+	auto resident = 2u ;
+	auto benchdir = std::filesystem::path() ;
+	auto statsfile = std::string() ;
+	auto synthetic = synthmap_t::options_t() ;
+	// The flags that take a value, which has to follow them
+	const auto valueflags = std::vector<std::string>{"--jobs","--resident","--delta","--radar","--stats","--benchmark","--density"} ;
+	for (auto i = 1 ; i < argc ; ++i){
+		auto arg = std::string(argv[i]) ;
+		if ((std::find(valueflags.begin(),valueflags.end(),arg) != valueflags.end()) && (i+1 >= argc)){
+			std::cerr << arg << " needs a value" << std::endl;
+			return 1 ;
+		}
+		auto valid = true ;
+		if (arg == "--jobs"){
+			valid = parseNumber(argv[++i], jobs) ;
+			if (jobs == 0) {
+				jobs = parallel::threads() ;
+			}
+		}
+		else if (arg == "--resident"){
+			valid = parseNumber(argv[++i], resident) ;
+			resident = std::max(resident,1u) ;
+		}
+		else if (arg == "--binary"){
+			options.binary = true ;
+		}
+		else if (arg == "--incremental"){
+			options.incremental = true ;
+		}
+		else if (arg == "--verify"){
+			options.verify = true ;
+		}
+		else if (arg == "--delta"){
+			options.previous = std::filesystem::path(argv[++i]) ;
+		}
+		else if (arg == "--radar"){
+			options.radar = std::filesystem::path(argv[++i]) ;
+		}
+		else if (arg == "--stats"){
+			statsfile = argv[++i] ;
+		}
+		else if (arg == "--benchmark"){
+			benchdir = std::filesystem::path(argv[++i]) ;
+		}
+		else if (arg == "--density"){
+			valid = parseNumber(argv[++i], synthetic.density) ;
+		}
+		else if (arg.compare(0, 2, "--") == 0){
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1 ;
+		}
+		else {
+			basedir = std::filesystem::path(arg);
+		}
+		if (!valid){
+			std::cerr << "Not a number for " << argv[i-1] << ": " << argv[i] << std::endl;
+			return 1 ;
+		}
+	}
+
+	if (!benchdir.empty()){
+		// One map at a time, so each has the machine to itself
+		auto error = std::error_code() ;
+		std::filesystem::create_directories(benchdir, error);
+		auto emit = [&options](const std::filesystem::path &directory, int mapnum){
+			auto listoptions = options ;
+			listoptions.output = directory ;
+			auto list = directory / std::filesystem::path(strutil::format("buildmap%i.lst",mapnum)) ;
+			return extractMap(directory, mapnum, listoptions) ? list : std::filesystem::path() ;
+		};
+		std::cout << "map phase milliseconds amount rate unit peakMB" << std::endl;
+		auto rvalue = 0 ;
+		for (auto mapnum = 0 ; mapnum < static_cast<int>(uomap_t::maxmap()) ; ++mapnum){
+			if (!benchmark_t::run(benchdir, mapnum, synthetic, emit, std::cout)){
+				report(std::cerr,mapnum,"Benchmark failed in: "s + benchdir.string());
+				rvalue = 1 ;
+			}
+		}
+		return rvalue ;
+	}
+
+	auto blocksFor = [](int mapnum) {
+		auto [width,height] = uomap_t::defaultSize(mapnum);
+		return static_cast<std::uint64_t>(width/8) * static_cast<std::uint64_t>(height/8) ;
+	};
+	auto largest = std::uint64_t(0) ;
+	for (auto mapnum = 0 ; mapnum < static_cast<int>(uomap_t::maxmap()) ; ++mapnum){
+		largest = std::max(largest,blocksFor(mapnum));
+	}
+	auto gate = residentgate_t(largest * resident) ;
+	// The maps running at once share the hardware threads
+	options.threads = std::max(parallel::threads() / jobs, 1u) ;
+	procinfo::countAllocations(!statsfile.empty());
+	// Each map only ever records into its own
+	auto mapstats = std::vector<phasestats_t>(uomap_t::maxmap()) ;
+	// Not vector<bool>, as the maps set theirs at once
+	auto succeeded = std::vector<std::uint8_t>(uomap_t::maxmap(),0) ;
+
+	parallel::forEach(uomap_t::maxmap(), jobs, [&](std::size_t index){
+		auto mapnum = static_cast<int>(index) ;
+		// A delta holds both versions of the map
+		auto blocks = blocksFor(mapnum) * (options.previous.empty() ? 1 : 2) ;
+		gate.acquire(blocks);
+		auto *stats = statsfile.empty() ? nullptr : &mapstats[index] ;
+		try {
+			auto phase = phasestats_t::scope_t(stats, options.previous.empty() ? "extractMap" : "deltaMap") ;
+			if (options.previous.empty()){
+				succeeded[index] = extractMap(basedir, mapnum, options, stats) ;
 			}
 			else {
-				std::cerr <<"Unable to load art, skipping" << std::endl;
+				succeeded[index] = deltaMap(basedir, mapnum, options, stats) ;
 			}
 		}
-		else {
-			std::cerr <<"Unable to load terrain, skipping" << std::endl;
+		catch (const std::exception &e){
+			report(std::cerr,mapnum,e.what());
 		}
+		gate.release(blocks);
+	});
+	if (!statsfile.empty() && !writeStats(statsfile, mapstats)){
+		std::cerr << "Error writing: " << statsfile << std::endl;
+		return 1 ;
 	}
-	return 0;
+	// So a run that lost a map doesn't look like it worked
+	return (std::count(succeeded.begin(),succeeded.end(),0) == 0) ? 0 : 1 ;
 }
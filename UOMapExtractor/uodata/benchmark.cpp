@@ -0,0 +1,118 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "benchmark.hpp"
+#include "uomap.hpp"
+#include "strutil.hpp"
+#include "procinfo.hpp"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <system_error>
+
+constexpr auto pointqueries = 200000 ;
+constexpr auto regionqueries = 20000 ;
+constexpr auto regionsize = 32 ;
+
+//=================================================================================
+static auto fileSize(const std::filesystem::path &path) ->std::uint64_t {
+	auto error = std::error_code() ;
+	auto size = std::filesystem::file_size(path, error) ;
+	return error ? 0 : static_cast<std::uint64_t>(size) ;
+}
+
+//=================================================================================
+auto benchmark_t::run(const std::filesystem::path &directory, int mapnum, const synthmap_t::options_t &options, const emitter_t &emit, std::ostream &output) ->bool {
+	using clock = std::chrono::steady_clock ;
+	auto start = clock::now() ;
+	auto begin = [&start](){
+		start = clock::now() ;
+	};
+	// amount is bytes for a unit of MB, otherwise a count
+	auto report = [&](const char *phase, std::uint64_t amount, const char *unit){
+		auto milliseconds = std::chrono::duration<double,std::milli>(clock::now() - start).count() ;
+		auto rate = (milliseconds > 0.0) ? static_cast<double>(amount) * 1000.0 / milliseconds : 0.0 ;
+		if (std::string(unit) == "MB"){
+			rate /= 1024.0 * 1024.0 ;
+		}
+		output << strutil::format("%i %-16s %10.2f %14llu %14.1f %s/s %8llu\n", mapnum, phase, milliseconds, static_cast<unsigned long long>(amount), rate, unit, static_cast<unsigned long long>(procinfo::peakResident() / (1024*1024))) << std::flush;
+	};
+	auto path = [&directory, mapnum](const char *format){
+		return directory / std::filesystem::path(strutil::format(format, mapnum)) ;
+	};
+
+	begin();
+	auto generated = synthmap_t::generate(directory, mapnum, options) ;
+	if (generated == 0){
+		return false ;
+	}
+	report("generate", generated, "MB");
+
+	auto uomap = uomap_t(mapnum) ;
+	begin();
+	if (!uomap.loadTerrainUOP(path("map%iLegacyMUL.uop"))){
+		return false ;
+	}
+	report("loadTerrainUOP", fileSize(path("map%iLegacyMUL.uop")), "MB");
+
+	begin();
+	if (!uomap.loadArt(path("staidx%i.mul").string(), path("statics%i.mul").string())){
+		return false ;
+	}
+	report("loadArt", fileSize(path("staidx%i.mul")) + fileSize(path("statics%i.mul")), "MB");
+
+	begin();
+	if (!uomap.applyArtDiff(path("stadifl%i.mul").string(), path("stadifi%i.mul").string(), path("stadif%i.mul").string())){
+		return false ;
+	}
+	report("applyArtDiff", fileSize(path("stadifl%i.mul")) / 4, "patches");
+
+	// The queries add up what they find, so they can't be skipped
+	auto [width,height] = uomap.size() ;
+	auto rng = std::mt19937(options.seed) ;
+	auto found = std::uint64_t(0) ;
+	begin();
+	for (auto query = 0 ; query < pointqueries ; ++query){
+		auto x = static_cast<int>(rng() % width) ;
+		auto y = static_cast<int>(rng() % height) ;
+		found += uomap.terrain(x, y).first ;
+		found += uomap.art(x, y).size() ;
+	}
+	report("pointQueries", pointqueries, "queries");
+
+	auto tiles = std::vector<uomap_t::regiontile_t>() ;
+	begin();
+	for (auto query = 0 ; query < regionqueries ; ++query){
+		auto x = static_cast<int>(rng() % (width - regionsize)) ;
+		auto y = static_cast<int>(rng() % (height - regionsize)) ;
+		found += uomap.terrainIn(x, y, x + regionsize - 1, y + regionsize - 1, tiles) ;
+		found += uomap.artIn(x, y, x + regionsize - 1, y + regionsize - 1, tiles) ;
+	}
+	report("regionQueries", regionqueries, "queries");
+
+	begin();
+	if (!uomap.writeArt(path("bench_staidx%i.mul").string(), path("bench_statics%i.mul").string())){
+		return false ;
+	}
+	report("writeArt", fileSize(path("bench_staidx%i.mul")) + fileSize(path("bench_statics%i.mul")), "MB");
+
+	begin();
+	if (!uomap.writeTerrainUOP(path("bench_map%iLegacyMUL.uop").string())){
+		return false ;
+	}
+	report("writeTerrainUOP", fileSize(path("bench_map%iLegacyMUL.uop")), "MB");
+	for (const auto *format : {"bench_staidx%i.mul", "bench_statics%i.mul", "bench_map%iLegacyMUL.uop"}){
+		auto error = std::error_code() ;
+		std::filesystem::remove(path(format), error);
+	}
+	uomap = uomap_t(mapnum) ;
+
+	// The whole extraction, as a run of the extractor does it (so loading as well)
+	begin();
+	auto list = emit(directory, mapnum) ;
+	if (list.empty()){
+		return false ;
+	}
+	report("emitList", fileSize(list), "MB");
+	return found > 0 ;
+}
@@ -0,0 +1,32 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef benchmark_hpp
+#define benchmark_hpp
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#include "synthmap.hpp"
+
+/*
+ Times the work of the extractor on a made up map (see synthmap.hpp), so it
+ can be run (and compared) anywhere, without a client.  For each phase there
+ is a line of
+ 	map phase milliseconds amount rate unit/s peakMB
+ (space separated, the amount being bytes, patches or queries, and the rate
+ that many a second, in MB for bytes), the peak being the most this process
+ has had resident by the end of the phase.
+ */
+//=================================================================================
+struct benchmark_t {
+	// Writes the command list of mapnum, from the client files in directory,
+	// returning its path (empty if it failed)
+	using emitter_t = std::function<std::filesystem::path(const std::filesystem::path &directory, int mapnum)> ;
+
+	static auto run(const std::filesystem::path &directory, int mapnum, const synthmap_t::options_t &options, const emitter_t &emit, std::ostream &output) ->bool ;
+};
+
+#endif /* benchmark_hpp */
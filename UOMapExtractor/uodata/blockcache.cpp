@@ -0,0 +1,94 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "blockcache.hpp"
+
+#include <algorithm>
+
+//=================================================================================
+auto blockcache_t::stats_t::operator+=(const stats_t &value) ->stats_t& {
+	hits += value.hits ;
+	misses += value.misses ;
+	evictions += value.evictions ;
+	resident += value.resident ;
+	peak += value.peak ;
+	return *this ;
+}
+
+//=================================================================================
+blockcache_t::blockcache_t(std::uint64_t budget) :limit(budget),hand(0),recent{none,none} {
+}
+
+//=================================================================================
+auto blockcache_t::reset(std::size_t count) ->void {
+	state.assign(count,0);
+	bytes.assign(count,0);
+	ring.clear();
+	hand = 0 ;
+	recent = {none,none} ;
+	counters.resident = 0 ;
+}
+
+//=================================================================================
+auto blockcache_t::makeRoom(std::uint64_t amount, const std::function<void(std::size_t)> &evict) ->void {
+	// Two full sweeps clear every referenced flag, so if we get past that
+	// without room, what is left is pinned
+	auto checked = std::size_t(0) ;
+	while ((counters.resident + amount > limit) && !ring.empty() && (checked < 2*ring.size())){
+		if (hand >= ring.size()){
+			hand = 0 ;
+		}
+		auto unit = ring[hand] ;
+		auto &flags = state[unit] ;
+		if (((flags & pinned_flag) != 0) || (unit == recent[0]) || (unit == recent[1])){
+			++hand ;
+			++checked ;
+		}
+		else if ((flags & referenced_flag) != 0){
+			flags &= ~referenced_flag ;
+			++hand ;
+			++checked ;
+		}
+		else {
+			evict(unit);
+			flags = 0 ;
+			counters.resident -= bytes[unit] ;
+			bytes[unit] = 0 ;
+			++counters.evictions ;
+			// The last unit takes its place, and is looked at next
+			ring[hand] = ring.back() ;
+			ring.pop_back();
+			checked = 0 ;
+		}
+	}
+}
+
+//=================================================================================
+auto blockcache_t::release(std::size_t first, std::size_t last) ->void {
+	auto kept = std::size_t(0) ;
+	for (auto unit : ring){
+		if ((unit >= first) && (unit < last)){
+			counters.resident -= bytes[unit] ;
+			bytes[unit] = 0 ;
+			state[unit] = 0 ;
+		}
+		else {
+			ring[kept++] = unit ;
+		}
+	}
+	ring.resize(kept);
+	hand = 0 ;
+}
+
+//=================================================================================
+auto blockcache_t::admit(std::size_t unit, std::uint32_t amount, const std::function<void(std::size_t)> &evict) ->void {
+	++counters.misses ;
+	if (bounded()){
+		makeRoom(amount, evict);
+	}
+	state[unit] = resident_flag | referenced_flag ;
+	bytes[unit] = amount ;
+	ring.push_back(unit);
+	touch(unit);
+	counters.resident += amount ;
+	counters.peak = std::max(counters.peak,counters.resident) ;
+}
@@ -0,0 +1,85 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef blockcache_hpp
+#define blockcache_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <functional>
+
+//=================================================================================
+// blockcache_t
+// Bookkeeping for a set of units (terrain sections, statics blocks) that are
+// read in on demand, and can be dropped and read in again.  It holds no data
+// itself, the owner tells it what was read in (admit) and used (hit), and it
+// says what to drop (through the evict callback) to stay inside the budget.
+// Eviction is CLOCK (second chance), pinned units (edited, so they can't be
+// read in again) are never evicted, nor are the last two units used (so a
+// caller can hold a terrain and a statics view of the same block while the
+// second is read in).  A budget of 0 is no limit.
+//=================================================================================
+class blockcache_t {
+public:
+	struct stats_t {
+		std::uint64_t hits = 0 ;
+		std::uint64_t misses = 0 ;
+		std::uint64_t evictions = 0 ;
+		std::uint64_t resident = 0 ;	// bytes
+		std::uint64_t peak = 0 ;		// bytes
+		auto operator+=(const stats_t &value) ->stats_t& ;
+	};
+
+private:
+	static constexpr std::uint8_t resident_flag = 1 ;
+	static constexpr std::uint8_t referenced_flag = 2 ;
+	static constexpr std::uint8_t pinned_flag = 4 ;
+	static constexpr std::size_t none = static_cast<std::size_t>(-1) ;
+
+	std::uint64_t limit ;
+	std::vector<std::uint8_t> state ;
+	std::vector<std::uint32_t> bytes ;
+	// The resident units, the clock hand sweeps round this
+	std::vector<std::size_t> ring ;
+	std::size_t hand ;
+	std::array<std::size_t,2> recent ;
+	stats_t counters ;
+
+	auto touch(std::size_t unit) ->void {
+		if (recent[0] != unit){
+			recent[1] = recent[0] ;
+			recent[0] = unit ;
+		}
+	}
+
+	auto makeRoom(std::uint64_t amount, const std::function<void(std::size_t)> &evict) ->void ;
+
+public:
+	blockcache_t(std::uint64_t budget = 0) ;
+
+	// Forget everything (nothing resident), for units [0,count)
+	auto reset(std::size_t count) ->void ;
+	auto budget(std::uint64_t value) ->void {limit = value;}
+	auto budget() const ->std::uint64_t {return limit;}
+	auto bounded() const ->bool {return limit != 0;}
+
+	auto resident(std::size_t unit) const ->bool {return (state[unit] & resident_flag) != 0;}
+	auto hit(std::size_t unit) ->void {
+		state[unit] |= referenced_flag ;
+		touch(unit);
+		++counters.hits ;
+	}
+	// The unit was read in (amount bytes).  Room is made for it first, so it
+	// is never its own victim.
+	auto admit(std::size_t unit, std::uint32_t amount, const std::function<void(std::size_t)> &evict) ->void ;
+	// The unit now holds data that can't be read in again
+	auto pin(std::size_t unit) ->void {state[unit] |= pinned_flag;}
+	auto pinned(std::size_t unit) const ->bool {return (state[unit] & pinned_flag) != 0;}
+	// Forget units [first,last) (the owner has dropped them, a reload), pinned or not
+	auto release(std::size_t first, std::size_t last) ->void ;
+
+	auto stats() const ->const stats_t& {return counters;}
+};
+
+#endif /* blockcache_hpp */
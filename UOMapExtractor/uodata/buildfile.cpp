@@ -0,0 +1,195 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "buildfile.hpp"
+#include "uomap.hpp"
+#include "strutil.hpp"
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+//=================================================================================
+buildfile_t::buildfile_t() :mapnumber(0),width(0),height(0),blocks(0),terrainsection(nullptr),staticsindex(nullptr),staticsrecords(nullptr) {
+}
+//=================================================================================
+buildfile_t::buildfile_t(const std::string &filepath) :buildfile_t() {
+	open(filepath);
+}
+
+//=================================================================================
+auto buildfile_t::open(const std::string &filepath) ->bool {
+	close();
+	if (!file.open(filepath)){
+		return false ;
+	}
+	const auto *base = file.data() ;
+	if (file.size() < header_size){
+		close();
+		return false ;
+	}
+	auto sig = std::uint32_t(0) ;
+	auto ver = std::uint32_t(0) ;
+	auto terrain_offset = std::uint64_t(0) ;
+	auto index_offset = std::uint64_t(0) ;
+	auto statics_offset = std::uint64_t(0) ;
+	auto statics_count = std::uint64_t(0) ;
+	std::memcpy(&sig,base,4);
+	std::memcpy(&ver,base+4,4);
+	std::memcpy(&mapnumber,base+8,4);
+	std::memcpy(&width,base+12,4);
+	std::memcpy(&height,base+16,4);
+	std::memcpy(&blocks,base+20,4);
+	std::memcpy(&terrain_offset,base+24,8);
+	std::memcpy(&index_offset,base+32,8);
+	std::memcpy(&statics_offset,base+40,8);
+	std::memcpy(&statics_count,base+48,8);
+	auto valid = (sig == signature) && (ver == version) && (width > 0) && (height > 0) ;
+	valid = valid && (static_cast<std::uint64_t>(blocks) == static_cast<std::uint64_t>(width/8) * static_cast<std::uint64_t>(height/8)) ;
+	valid = valid && (terrain_offset + static_cast<std::uint64_t>(blocks) * terrain_block_size <= file.size()) ;
+	valid = valid && ((index_offset % 4) == 0) && (index_offset + (static_cast<std::uint64_t>(blocks)+1) * 4 <= file.size()) ;
+	valid = valid && ((statics_offset % 8) == 0) && (statics_offset + statics_count * sizeof(staticrecord_t) <= file.size()) ;
+	if (!valid){
+		close();
+		return false ;
+	}
+	terrainsection = base + terrain_offset ;
+	staticsindex = reinterpret_cast<const std::uint32_t*>(base + index_offset) ;
+	staticsrecords = reinterpret_cast<const staticrecord_t*>(base + statics_offset) ;
+	// The index has to run from 0 to statics_count without going back, or
+	// statics() would hand out ranges outside the records
+	valid = (staticsindex[0] == 0) && (staticsindex[blocks] == statics_count) ;
+	for (std::uint32_t entry = 0 ; valid && (entry < blocks) ; ++entry){
+		valid = staticsindex[entry] <= staticsindex[entry+1] ;
+	}
+	if (!valid){
+		close();
+		return false ;
+	}
+	return true ;
+}
+//=================================================================================
+auto buildfile_t::close() ->void {
+	file.close();
+	mapnumber = 0 ;
+	width = 0 ;
+	height = 0 ;
+	blocks = 0 ;
+	terrainsection = nullptr ;
+	staticsindex = nullptr ;
+	staticsrecords = nullptr ;
+}
+//=================================================================================
+auto buildfile_t::is_open() const ->bool {
+	return terrainsection != nullptr ;
+}
+
+//=================================================================================
+auto buildfile_t::block(int x, int y) const ->std::uint32_t {
+	if ((x < 0) || (y < 0) || (x >= width) || (y >= height)) {
+		throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
+	}
+	return static_cast<std::uint32_t>((x/8) * (height/8) + (y/8)) ;
+}
+//=================================================================================
+auto buildfile_t::terrainBlock(std::uint32_t block) const ->const std::uint8_t* {
+	if (block >= blocks) {
+		throw std::out_of_range(strutil::format("Invalid block %u, map has %u",block,blocks));
+	}
+	return terrainsection + static_cast<std::size_t>(block) * terrain_block_size ;
+}
+//=================================================================================
+auto buildfile_t::terrain(int x, int y) const ->std::pair<std::uint16_t,std::int8_t> {
+	const auto *cell = terrainBlock(block(x,y)) + ((y%8)*8 + (x%8)) * 3 ;
+	auto tileid = std::uint16_t(0) ;
+	auto altitude = std::int8_t(0) ;
+	std::memcpy(&tileid,cell,2);
+	std::memcpy(&altitude,cell+2,1);
+	return std::make_pair(tileid,altitude);
+}
+//=================================================================================
+auto buildfile_t::statics(std::uint32_t block) const ->std::pair<const staticrecord_t*,const staticrecord_t*> {
+	if (block >= blocks) {
+		throw std::out_of_range(strutil::format("Invalid block %u, map has %u",block,blocks));
+	}
+	return std::make_pair(staticsrecords + staticsindex[block], staticsrecords + staticsindex[block+1]);
+}
+
+//=================================================================================
+auto buildfile_t::write(const uomap_t &uomap, const std::string &filepath) ->bool {
+	auto output = std::ofstream(filepath,std::ios::binary) ;
+	if (!output.is_open()){
+		return false ;
+	}
+	auto [mapwidth,mapheight] = uomap.size() ;
+	auto mapnum = static_cast<std::int32_t>(uomap.map()) ;
+	auto blockcount = static_cast<std::uint32_t>((mapwidth/8) * (mapheight/8)) ;
+	auto terrain_offset = static_cast<std::uint64_t>(header_size) ;
+	auto index_offset = terrain_offset + static_cast<std::uint64_t>(blockcount) * terrain_block_size ;
+	auto statics_offset = index_offset + (static_cast<std::uint64_t>(blockcount)+1) * 4 ;
+	statics_offset = (statics_offset + 7) & ~std::uint64_t(7) ;
+
+	// Header and index are written last, once we know the statics layout
+	auto header = std::vector<char>(header_size,0) ;
+	output.write(header.data(),header.size());
+
+	auto chunk = std::vector<std::uint8_t>() ;
+	chunk.reserve(1024*terrain_block_size);
+	uomap.forEachBlock([&](int, int, const terrainview_t &terrain, const artblock_t &){
+		// The terrain mul block, without its header
+		chunk.insert(chunk.end(), terrain.data()+4, terrain.data()+4+terrain_block_size);
+		if (chunk.size() >= 1024*terrain_block_size){
+			output.write(reinterpret_cast<const char*>(chunk.data()),chunk.size());
+			chunk.clear();
+		}
+	});
+	output.write(reinterpret_cast<const char*>(chunk.data()),chunk.size());
+	chunk.clear();
+
+	auto index = std::vector<std::uint32_t>(static_cast<std::size_t>(blockcount)+1,0) ;
+	output.write(reinterpret_cast<const char*>(index.data()),index.size()*4);
+	auto pad = std::vector<char>(statics_offset - (index_offset + index.size()*4),0) ;
+	output.write(pad.data(),pad.size());
+
+	auto records = std::vector<staticrecord_t>() ;
+	auto cellrecords = std::vector<artrecord_t>() ;
+	auto cells = artcells_t() ;
+	auto count = std::uint64_t(0) ;
+	auto block = std::uint32_t(0) ;
+	uomap.forEachBlock([&](int, int, const terrainview_t &, const artblock_t &art){
+		index[block++] = static_cast<std::uint32_t>(count) ;
+		cellrecords.clear();
+		art.cells(cellrecords, cells);
+		for (auto cell = 0 ; cell < 64 ; ++cell){
+			for (auto i = cells[cell] ; i < cells[cell+1] ; ++i){
+				const auto &entry = cellrecords[i] ;
+				records.push_back(staticrecord_t{entry.tileid,static_cast<std::uint8_t>(cell%8),static_cast<std::uint8_t>(cell/8),entry.altitude,0,entry.hue});
+			}
+		}
+		count += cellrecords.size() ;
+		if (records.size() >= 64*1024){
+			output.write(reinterpret_cast<const char*>(records.data()),records.size()*sizeof(staticrecord_t));
+			records.clear();
+		}
+	});
+	output.write(reinterpret_cast<const char*>(records.data()),records.size()*sizeof(staticrecord_t));
+	index[blockcount] = static_cast<std::uint32_t>(count) ;
+
+	auto sig = signature ;
+	auto ver = version ;
+	std::memcpy(header.data(),&sig,4);
+	std::memcpy(header.data()+4,&ver,4);
+	std::memcpy(header.data()+8,&mapnum,4);
+	std::memcpy(header.data()+12,&mapwidth,4);
+	std::memcpy(header.data()+16,&mapheight,4);
+	std::memcpy(header.data()+20,&blockcount,4);
+	std::memcpy(header.data()+24,&terrain_offset,8);
+	std::memcpy(header.data()+32,&index_offset,8);
+	std::memcpy(header.data()+40,&statics_offset,8);
+	std::memcpy(header.data()+48,&count,8);
+	output.seekp(0,std::ios::beg);
+	output.write(header.data(),header.size());
+	output.seekp(static_cast<std::streamoff>(index_offset),std::ios::beg);
+	output.write(reinterpret_cast<const char*>(index.data()),index.size()*4);
+	return output.good() ;
+}
@@ -0,0 +1,94 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef buildfile_hpp
+#define buildfile_hpp
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "mappedfile.hpp"
+
+class uomap_t ;
+/*
+ Binary form of buildmap%i.lst, meant to be mapped and used in place
+ (no parsing).  All values are little endian.
+
+ Header (64 bytes):
+ 	char			signature[4] ;		// "UOBM"
+ 	std::uint32_t	version ;			// 1
+ 	std::int32_t	mapnumber ;
+ 	std::int32_t	width ;
+ 	std::int32_t	height ;
+ 	std::uint32_t	blocks ;			// (width/8) * (height/8)
+ 	std::uint64_t	terrain_offset ;	// offset of the terrain section
+ 	std::uint64_t	index_offset ;		// offset of the statics index
+ 	std::uint64_t	statics_offset ;	// offset of the statics records
+ 	std::uint64_t	statics_count ;		// number of statics records
+ 	(padding to 64)
+
+ Terrain section:
+ 	For each block (in mul block order, block = (x/8)*(height/8) + (y/8)),
+ 	64 cells of { std::uint16_t tileid; std::int8_t altitude; } (3 bytes each),
+ 	cell = (y%8)*8 + (x%8).  This is a terrain mul block without its header.
+
+ Statics index:
+ 	blocks+1 std::uint32_t, the first record for each block.  The records for
+ 	block b are [index[b], index[b+1]).
+
+ Statics records (8 byte aligned):
+ 	staticrecord_t, grouped by block, and within a block by cell (y then x), in
+ 	the order the map holds them.
+ */
+//=================================================================================
+class buildfile_t {
+public:
+	static constexpr std::uint32_t signature = 0x4D424F55 ; // "UOBM"
+	static constexpr std::uint32_t version = 1 ;
+	static constexpr std::size_t header_size = 64 ;
+	static constexpr std::size_t terrain_block_size = 192 ;
+
+	struct staticrecord_t {
+		std::uint16_t	tileid ;
+		std::uint8_t	x ;			// in block (0-7)
+		std::uint8_t	y ;			// in block (0-7)
+		std::int8_t		altitude ;
+		std::uint8_t	reserved ;
+		std::uint16_t	hue ;
+	};
+	static_assert(sizeof(staticrecord_t) == 8, "staticrecord_t must be 8 bytes");
+
+private:
+	mappedfile_t file ;
+	int mapnumber ;
+	int width ;
+	int height ;
+	std::uint32_t blocks ;
+	const std::uint8_t *terrainsection ;
+	const std::uint32_t *staticsindex ;
+	const staticrecord_t *staticsrecords ;
+
+public:
+	buildfile_t() ;
+	buildfile_t(const std::string &filepath) ;
+
+	auto open(const std::string &filepath) ->bool ;
+	auto close() ->void ;
+	auto is_open() const ->bool ;
+
+	auto map() const ->int {return mapnumber;}
+	auto size() const ->std::pair<int,int> {return std::make_pair(width,height);}
+	auto blockCount() const ->std::uint32_t {return blocks;}
+	auto block(int x, int y) const ->std::uint32_t ;
+
+	// 192 bytes, the 64 terrain cells of the block (this and statics throw
+	// std::out_of_range for a block past the map)
+	auto terrainBlock(std::uint32_t block) const ->const std::uint8_t* ;
+	auto terrain(int x, int y) const ->std::pair<std::uint16_t,std::int8_t> ;
+	// [first,last) statics records of the block
+	auto statics(std::uint32_t block) const ->std::pair<const staticrecord_t*,const staticrecord_t*> ;
+
+	static auto write(const uomap_t &uomap, const std::string &filepath) ->bool ;
+};
+
+#endif /* buildfile_hpp */
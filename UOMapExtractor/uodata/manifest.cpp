@@ -0,0 +1,125 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "manifest.hpp"
+
+#include <fstream>
+#include <system_error>
+
+//=================================================================================
+auto manifest_t::fingerprint(const std::filesystem::path &path) ->source_t {
+	auto rvalue = source_t() ;
+	auto error = std::error_code() ;
+	auto size = std::filesystem::file_size(path, error) ;
+	if (!error){
+		rvalue.size = static_cast<std::uint64_t>(size) ;
+		auto stamp = std::filesystem::last_write_time(path, error) ;
+		if (!error){
+			rvalue.stamp = static_cast<std::int64_t>(stamp.time_since_epoch().count()) ;
+		}
+	}
+	return rvalue ;
+}
+
+//=================================================================================
+manifest_t::manifest_t() :mapnumber(0),width(0),height(0),preamble(0) {
+}
+//=================================================================================
+auto manifest_t::clear() ->void {
+	mapnumber = 0 ;
+	width = 0 ;
+	height = 0 ;
+	preamble = 0 ;
+	list = source_t() ;
+	binary = source_t() ;
+	sources.clear();
+	terrainhashes.clear();
+	arthashes.clear();
+	segments.clear();
+}
+
+//=================================================================================
+auto manifest_t::load(const std::string &filepath) ->bool {
+	clear();
+	auto input = std::ifstream(filepath,std::ios::binary) ;
+	if (!input.is_open()){
+		return false ;
+	}
+	auto sig = std::uint32_t(0) ;
+	auto ver = std::uint32_t(0) ;
+	auto sourcecount = std::uint32_t(0) ;
+	auto sectioncount = std::uint32_t(0) ;
+	auto segmentcount = std::uint32_t(0) ;
+	input.read(reinterpret_cast<char*>(&sig),4);
+	input.read(reinterpret_cast<char*>(&ver),4);
+	input.read(reinterpret_cast<char*>(&mapnumber),4);
+	input.read(reinterpret_cast<char*>(&width),4);
+	input.read(reinterpret_cast<char*>(&height),4);
+	input.read(reinterpret_cast<char*>(&sourcecount),4);
+	input.read(reinterpret_cast<char*>(&sectioncount),4);
+	input.read(reinterpret_cast<char*>(&segmentcount),4);
+	input.read(reinterpret_cast<char*>(&preamble),8);
+	for (auto *source : {&list,&binary}){
+		input.read(reinterpret_cast<char*>(&source->size),8);
+		input.read(reinterpret_cast<char*>(&source->stamp),8);
+	}
+	if (!input.good() || (sig != signature) || (ver != version) || (width <= 0) || (height <= 0)){
+		clear();
+		return false ;
+	}
+	// Nothing can be bigger than one entry per tile
+	auto tiles = static_cast<std::uint64_t>(width) * static_cast<std::uint64_t>(height) ;
+	if ((sourcecount > 64) || (sectioncount > tiles) || (segmentcount > tiles)){
+		clear();
+		return false ;
+	}
+	sources.resize(sourcecount);
+	for (auto &source : sources){
+		input.read(reinterpret_cast<char*>(&source.size),8);
+		input.read(reinterpret_cast<char*>(&source.stamp),8);
+	}
+	terrainhashes.resize(sectioncount);
+	arthashes.resize(sectioncount);
+	segments.resize(segmentcount);
+	input.read(reinterpret_cast<char*>(terrainhashes.data()),static_cast<std::streamsize>(sectioncount)*4);
+	input.read(reinterpret_cast<char*>(arthashes.data()),static_cast<std::streamsize>(sectioncount)*4);
+	input.read(reinterpret_cast<char*>(segments.data()),static_cast<std::streamsize>(segmentcount)*4);
+	if (!input.good()){
+		clear();
+		return false ;
+	}
+	return true ;
+}
+
+//=================================================================================
+auto manifest_t::save(const std::string &filepath) const ->bool {
+	auto output = std::ofstream(filepath,std::ios::binary) ;
+	if (!output.is_open()){
+		return false ;
+	}
+	auto sig = signature ;
+	auto ver = version ;
+	auto sourcecount = static_cast<std::uint32_t>(sources.size()) ;
+	auto sectioncount = static_cast<std::uint32_t>(terrainhashes.size()) ;
+	auto segmentcount = static_cast<std::uint32_t>(segments.size()) ;
+	output.write(reinterpret_cast<const char*>(&sig),4);
+	output.write(reinterpret_cast<const char*>(&ver),4);
+	output.write(reinterpret_cast<const char*>(&mapnumber),4);
+	output.write(reinterpret_cast<const char*>(&width),4);
+	output.write(reinterpret_cast<const char*>(&height),4);
+	output.write(reinterpret_cast<const char*>(&sourcecount),4);
+	output.write(reinterpret_cast<const char*>(&sectioncount),4);
+	output.write(reinterpret_cast<const char*>(&segmentcount),4);
+	output.write(reinterpret_cast<const char*>(&preamble),8);
+	for (const auto *source : {&list,&binary}){
+		output.write(reinterpret_cast<const char*>(&source->size),8);
+		output.write(reinterpret_cast<const char*>(&source->stamp),8);
+	}
+	for (const auto &source : sources){
+		output.write(reinterpret_cast<const char*>(&source.size),8);
+		output.write(reinterpret_cast<const char*>(&source.stamp),8);
+	}
+	output.write(reinterpret_cast<const char*>(terrainhashes.data()),static_cast<std::streamsize>(sectioncount)*4);
+	output.write(reinterpret_cast<const char*>(arthashes.data()),static_cast<std::streamsize>(sectioncount)*4);
+	output.write(reinterpret_cast<const char*>(segments.data()),static_cast<std::streamsize>(segmentcount)*4);
+	return output.good() ;
+}
@@ -0,0 +1,70 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef manifest_hpp
+#define manifest_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+/*
+ What an incremental run of the extractor knows about the previous run of a
+ map (buildmap%i.manifest, next to buildmap%i.lst).  All values are little
+ endian.
+
+ 	char			signature[4] ;		// "UOMF"
+ 	std::uint32_t	version ;			// 2
+ 	std::int32_t	mapnumber ;
+ 	std::int32_t	width ;
+ 	std::int32_t	height ;
+ 	std::uint32_t	source_count ;
+ 	std::uint32_t	section_count ;
+ 	std::uint32_t	segment_count ;
+ 	std::uint64_t	preamble ;			// list characters before the first segment
+ 	source_t		list ;				// the buildmap%i.lst this describes
+ 	source_t		binary ;			// and buildmap%i.bin (0s if not written)
+ 	source_t		sources[source_count] ;			// size, stamp (8 bytes each)
+ 	std::uint32_t	terrain_hash[section_count] ;
+ 	std::uint32_t	art_hash[section_count] ;
+ 	std::uint32_t	segment_length[segment_count] ;	// list characters, in list order
+
+ A segment is the run of tiles in one row of the map that are in the same
+ section (see uomap_t::forEachTileByRow), so an unchanged section's part of
+ the list can be copied from the previous list.  That is only safe if the list
+ is still the one the manifest was saved with (some other run may have
+ written it since), so its size and stamp are kept as well.
+ */
+//=================================================================================
+struct manifest_t {
+	static constexpr std::uint32_t signature = 0x464D4F55 ; // "UOMF"
+	static constexpr std::uint32_t version = 2 ;
+
+	//=============================================================================
+	// A source file's size and last write time, the quick check for a change
+	struct source_t {
+		std::uint64_t size = 0 ;
+		std::int64_t stamp = 0 ;
+		auto operator==(const source_t &value) const ->bool {return (size == value.size) && (stamp == value.stamp);}
+		auto operator!=(const source_t &value) const ->bool {return !(*this == value);}
+	};
+	static auto fingerprint(const std::filesystem::path &path) ->source_t ;
+
+	int mapnumber ;
+	int width ;
+	int height ;
+	std::uint64_t preamble ;
+	source_t list ;
+	source_t binary ;
+	std::vector<source_t> sources ;
+	std::vector<std::uint32_t> terrainhashes ;
+	std::vector<std::uint32_t> arthashes ;
+	std::vector<std::uint32_t> segments ;
+
+	manifest_t() ;
+	auto clear() ->void ;
+	auto load(const std::string &filepath) ->bool ;
+	auto save(const std::string &filepath) const ->bool ;
+};
+
+#endif /* manifest_hpp */
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include <iterator>
+#include <limits>
 
 using namespace std::string_literals;
 
@@ -14,55 +15,37 @@ using namespace std::string_literals;
 //=================================================================================
 
 //=================================================================================
-terrainblock_t::terrainblock_t(std::int32_t blockheader ) {
-	blockdata.resize(196,0);
-	std::copy(reinterpret_cast<std::uint8_t*>(&blockheader),reinterpret_cast<std::uint8_t*>(&blockheader)+4,blockdata.data());
-	
-}
-
-//=================================================================================
-terrainblock_t::terrainblock_t(const std::uint8_t* data){
-	blockdata.resize(196,0);
-	if (data != nullptr){
-		std::copy(data,data+196,blockdata.data());
-	}
-
+terrainblock_t::terrainblock_t(std::uint8_t* data):blockdata(data){
 }
 
 //=================================================================================
 auto terrainblock_t::header() const ->std::int32_t {
-	return  *reinterpret_cast<const std::int32_t*>(blockdata.data()) ;
+	return terrainview_t(blockdata).header() ;
 }
 //=================================================================================
 auto terrainblock_t::header(std::int32_t value) ->void{
-	*reinterpret_cast< std::int32_t*>(blockdata.data()) = value ;
+	std::copy(reinterpret_cast<std::uint8_t*>(&value),reinterpret_cast<std::uint8_t*>(&value)+4,blockdata);
 }
 
 //=================================================================================
-auto terrainblock_t::raw() const -> const std::vector<std::uint8_t>& {
+auto terrainblock_t::data() const -> const std::uint8_t* {
 	return blockdata ;
 }
 
 //=================================================================================
-auto terrainblock_t::raw()  ->  std::vector<std::uint8_t>& {
+auto terrainblock_t::data()  ->  std::uint8_t* {
 	return blockdata ;
 }
 
 //=================================================================================
 auto terrainblock_t::terrain(int x, int y) const -> std::pair<std::uint16_t,std::int8_t> {
-	auto offset = (x*3) + (y*24) + 4 ;
-	auto tileid = std::uint16_t(0) ;
-	auto altitude = std::int8_t(0) ;
-	std::copy(blockdata.data()+offset,blockdata.data()+offset + 2,reinterpret_cast<std::uint8_t*>(&tileid));
-	std::copy(blockdata.data()+offset+2,blockdata.data()+offset + 3,reinterpret_cast<std::uint8_t*>(&altitude));
-
-	return std::make_pair(tileid, altitude);
+	return terrainview_t(blockdata).terrain(x, y) ;
 }
 //=================================================================================
 auto terrainblock_t::terrain(int x, int y, std::uint16_t tileid, std::int8_t altitude) ->void {
 	auto offset = (x*3) + (y*24) + 4 ;
-	std::copy(reinterpret_cast<std::uint8_t*>(&tileid),reinterpret_cast<std::uint8_t*>(&tileid)+2,blockdata.data()+offset);
-	std::copy(reinterpret_cast<std::uint8_t*>(&altitude),reinterpret_cast<std::uint8_t*>(&altitude)+1,blockdata.data()+offset+2);
+	std::copy(reinterpret_cast<std::uint8_t*>(&tileid),reinterpret_cast<std::uint8_t*>(&tileid)+2,blockdata+offset);
+	std::copy(reinterpret_cast<std::uint8_t*>(&altitude),reinterpret_cast<std::uint8_t*>(&altitude)+1,blockdata+offset+2);
 }
 
 //=================================================================================
@@ -74,6 +57,33 @@ auto terrainblock_t::fill(std::uint16_t tileid, std::int8_t altitude) ->void {
 	}
 }
 
+//=================================================================================
+terrainview_t::terrainview_t(const std::uint8_t* data):blockdata(data){
+}
+//=================================================================================
+terrainview_t::terrainview_t(const terrainblock_t &block):blockdata(block.data()){
+}
+//=================================================================================
+auto terrainview_t::header() const ->std::int32_t {
+	auto value = std::int32_t(0) ;
+	std::copy(blockdata,blockdata+4,reinterpret_cast<std::uint8_t*>(&value));
+	return value ;
+}
+//=================================================================================
+auto terrainview_t::data() const -> const std::uint8_t* {
+	return blockdata ;
+}
+//=================================================================================
+auto terrainview_t::terrain(int x, int y) const -> std::pair<std::uint16_t,std::int8_t> {
+	auto offset = (x*3) + (y*24) + 4 ;
+	auto tileid = std::uint16_t(0) ;
+	auto altitude = std::int8_t(0) ;
+	std::copy(blockdata+offset,blockdata+offset + 2,reinterpret_cast<std::uint8_t*>(&tileid));
+	std::copy(blockdata+offset+2,blockdata+offset + 3,reinterpret_cast<std::uint8_t*>(&altitude));
+
+	return std::make_pair(tileid, altitude);
+}
+
 
 //=================================================================================
 
@@ -93,35 +103,148 @@ artblock_t::artblock_t(const std::uint8_t *data, size_t size) :artblock_t(){
 	}
 }
 //=================================================================================
-artblock_t::artblock_t() {
+artblock_t::artblock_t():viewdata(nullptr),viewsize(0) {
 	blockdata.clear();
 	blockdata.resize(0);
 }
+//=================================================================================
+artblock_t::artblock_t(const artblock_t &value) :blockdata(value.blockdata),viewdata(value.viewdata),viewsize(value.viewsize) {
+	if (value.index != nullptr){
+		index = std::make_unique<artindex_t>(*value.index) ;
+	}
+}
+//=================================================================================
+auto artblock_t::operator=(const artblock_t &value) ->artblock_t& {
+	if (this != &value){
+		blockdata = value.blockdata ;
+		viewdata = value.viewdata ;
+		viewsize = value.viewsize ;
+		index.reset();
+		if (value.index != nullptr){
+			index = std::make_unique<artindex_t>(*value.index) ;
+		}
+	}
+	return *this ;
+}
+
+//=================================================================================
+auto artblock_t::record(std::size_t number) const ->std::tuple<std::uint16_t,std::int8_t,std::uint16_t> {
+	const auto *data = this->data() + number*7 ;
+	auto tileid = std::uint16_t(0) ;
+	auto hue = std::uint16_t(0) ;
+	std::copy(data,data+2,reinterpret_cast<std::uint8_t*>(&tileid));
+	std::copy(data+5,data+7,reinterpret_cast<std::uint8_t*>(&hue));
+	return std::make_tuple(tileid,static_cast<std::int8_t>(data[4]),hue);
+}
 
 //=================================================================================
 auto artblock_t::size() const ->size_t {
-	return blockdata.size();
+	return (viewdata != nullptr)? viewsize : blockdata.size();
 }
 
 //=================================================================================
-auto artblock_t::raw() const -> const std::vector<std::uint8_t>& {
-	return blockdata;
+auto artblock_t::data() const -> const std::uint8_t* {
+	return (viewdata != nullptr)? viewdata : blockdata.data();
 }
 //=================================================================================
 auto artblock_t::raw()  -> std::vector<std::uint8_t>& {
+	detach();
+	index.reset();
 	return blockdata;
 }
 
+//=================================================================================
+auto artblock_t::view(const std::uint8_t *data, size_t size) ->void {
+	std::vector<std::uint8_t>().swap(blockdata);
+	viewdata = (size > 0) ? data : nullptr ;
+	viewsize = (viewdata != nullptr) ? static_cast<std::uint32_t>(size) : 0 ;
+	if (index != nullptr){
+		buildIndex();
+	}
+}
+//=================================================================================
+auto artblock_t::shared() const ->bool {
+	return viewdata != nullptr ;
+}
+//=================================================================================
+auto artblock_t::detach() ->void {
+	if (viewdata != nullptr){
+		blockdata.assign(viewdata, viewdata + viewsize);
+		viewdata = nullptr ;
+		viewsize = 0 ;
+	}
+}
+
 
 //=================================================================================
 auto artblock_t::clear() ->void {
+	viewdata = nullptr ;
+	viewsize = 0 ;
 	blockdata.clear();
 	blockdata.resize(0) ;
+	if (index != nullptr){
+		index->offsets.fill(0);
+		index->order.clear();
+	}
 }
 
+//=================================================================================
+auto artblock_t::buildIndex() ->void {
+	const auto *bytes = data() ;
+	auto count = size()/7 ;
+	if (count > std::numeric_limits<std::uint16_t>::max()){
+		// Record numbers would not fit, so this block just stays a scan
+		index.reset();
+		return ;
+	}
+	if (index == nullptr){
+		index = std::make_unique<artindex_t>() ;
+	}
+	auto &offsets = index->offsets ;
+	auto &order = index->order ;
+	offsets.fill(0);
+	for (std::size_t i = 0 ; i < count ; ++i){
+		auto xloc = bytes[i*7+2] ;
+		auto yloc = bytes[i*7+3] ;
+		if ((xloc < 8) && (yloc < 8)){
+			offsets[yloc*8 + xloc + 1]++ ;
+		}
+	}
+	for (auto cell = 1 ; cell < 65 ; ++cell){
+		offsets[cell] += offsets[cell-1] ;
+	}
+	order.resize(offsets[64]);
+	auto next = std::array<std::uint32_t,64>() ;
+	std::copy(offsets.begin(),offsets.begin()+64,next.begin());
+	for (std::size_t i = 0 ; i < count ; ++i){
+		auto xloc = bytes[i*7+2] ;
+		auto yloc = bytes[i*7+3] ;
+		if ((xloc < 8) && (yloc < 8)){
+			order[next[yloc*8 + xloc]++] = static_cast<std::uint16_t>(i) ;
+		}
+	}
+	auto altitude = [bytes](std::uint16_t number){
+		return static_cast<std::int8_t>(bytes[number*7+4]);
+	};
+	for (auto cell = 0 ; cell < 64 ; ++cell){
+		std::stable_sort(order.begin()+offsets[cell],order.begin()+offsets[cell+1],[&altitude](std::uint16_t lhs,std::uint16_t rhs){
+			return altitude(lhs) < altitude(rhs);
+		});
+	}
+}
+//=================================================================================
+auto artblock_t::dropIndex() ->void {
+	index.reset();
+}
+//=================================================================================
+auto artblock_t::indexed() const ->bool {
+	return index != nullptr ;
+}
 
 //================================================================================
 auto artblock_t::art(int x, int y, std::uint16_t tileid, std::int8_t altitude, std::uint16_t hue ) ->void {
+	// Our first change to a shared block gets it its own copy
+	detach();
 	auto size = blockdata.size() ;
 	blockdata.resize(size+7);
 	auto xloc = static_cast<std::uint8_t>(x) ;
@@ -131,27 +254,44 @@ auto artblock_t::art(int x, int y, std::uint16_t tileid, std::int8_t altitude, s
 	std::copy(&yloc,&yloc + 1,blockdata.data()+size + 3);
 	std::copy(reinterpret_cast<std::uint8_t*>(&altitude),reinterpret_cast<std::uint8_t*>(&altitude) + 1,blockdata.data()+size + 4);
 	std::copy(reinterpret_cast<std::uint8_t*>(&hue),reinterpret_cast<std::uint8_t*>(&hue)+2,blockdata.data()+size+5);
+	if (index != nullptr){
+		auto number = size/7 ;
+		if ((number > std::numeric_limits<std::uint16_t>::max()) || (xloc >= 8) || (yloc >= 8)){
+			buildIndex();
+			return ;
+		}
+		// Slot it in after any records in the cell at the same (or lower) altitude
+		auto cell = yloc*8 + xloc ;
+		auto &offsets = index->offsets ;
+		auto &order = index->order ;
+		auto iter = std::upper_bound(order.begin()+offsets[cell],order.begin()+offsets[cell+1],altitude,[this](std::int8_t alt, std::uint16_t rhs){
+			return alt < static_cast<std::int8_t>(blockdata[rhs*7+4]);
+		});
+		order.insert(iter,static_cast<std::uint16_t>(number));
+		for (auto entry = cell+1 ; entry < 65 ; ++entry){
+			offsets[entry]++ ;
+		}
+	}
 }
 
 //================================================================================
 auto artblock_t::art(int x, int y) const -> std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>> {
 	auto rvalue = std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>>() ;
-	auto tileid = std::uint16_t(0) ;
-	auto altitude = std::int8_t(0) ;
-	auto hue = std::uint16_t(0) ;
+	if ((index != nullptr) && (x >= 0) && (x < 8) && (y >= 0) && (y < 8)){
+		auto cell = y*8 + x ;
+		rvalue.reserve(index->offsets[cell+1] - index->offsets[cell]);
+		for (auto i = index->offsets[cell] ; i < index->offsets[cell+1] ; ++i){
+			rvalue.push_back(record(index->order[i]));
+		}
+		return rvalue ;
+	}
 	auto xloc = static_cast<std::uint8_t>(x) ;
 	auto yloc = static_cast<std::uint8_t>(y) ;
-	int offset = 0 ;
-	while (offset < blockdata.size()){
-		std::copy(blockdata.data()+offset,blockdata.data() + offset + 2, reinterpret_cast<std::uint8_t*>(&tileid));
-		std::copy(blockdata.data()+offset+2,blockdata.data() + offset + 3, &xloc);
-		std::copy(blockdata.data()+offset+3,blockdata.data() + offset + 4, &yloc);
-		std::copy(blockdata.data()+offset+4,blockdata.data() + offset + 5, reinterpret_cast<std::uint8_t*>(&altitude));
-		std::copy(blockdata.data()+offset+5,blockdata.data() + offset + 7, reinterpret_cast<std::uint8_t*>(&hue));
-		if ((static_cast<int>(xloc) == x) && (static_cast<int>(yloc) == y)){
-			rvalue.push_back(std::make_tuple(tileid,altitude,hue));
+	const auto *bytes = data() ;
+	for (std::size_t offset = 0 ; offset + 7 <= size() ; offset += 7){
+		if ((bytes[offset+2] == xloc) && (bytes[offset+3] == yloc)){
+			rvalue.push_back(record(offset/7));
 		}
-		offset += 7 ;
 	}
 	return rvalue ;
 
@@ -159,22 +299,29 @@ auto artblock_t::art(int x, int y) const -> std::vector<std::tuple<std::uint16_t
 //================================================================================
 auto artblock_t::art(int x, int y,int alt) const -> std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>> {
 	auto rvalue = std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>>() ;
-	auto tileid = std::uint16_t(0) ;
-	auto altitude = std::int8_t(0) ;
-	auto hue = std::uint16_t(0) ;
+	if ((index != nullptr) && (x >= 0) && (x < 8) && (y >= 0) && (y < 8)){
+		auto cell = y*8 + x ;
+		auto first = index->order.begin() + index->offsets[cell] ;
+		auto last = index->order.begin() + index->offsets[cell+1] ;
+		const auto *bytes = data() ;
+		auto altitude = [bytes](std::uint16_t number){
+			return static_cast<int>(static_cast<std::int8_t>(bytes[number*7+4]));
+		};
+		auto iter = std::lower_bound(first,last,alt,[&altitude](std::uint16_t lhs, int value){
+			return altitude(lhs) < value ;
+		});
+		for (; (iter != last) && (altitude(*iter) == alt) ; ++iter){
+			rvalue.push_back(record(*iter));
+		}
+		return rvalue ;
+	}
 	auto xloc = static_cast<std::uint8_t>(x) ;
 	auto yloc = static_cast<std::uint8_t>(y) ;
-	int offset = 0 ;
-	while (offset < blockdata.size()){
-		std::copy(blockdata.data()+offset,blockdata.data() + offset + 2, reinterpret_cast<std::uint8_t*>(&tileid));
-		std::copy(blockdata.data()+offset+2,blockdata.data() + offset + 3, &xloc);
-		std::copy(blockdata.data()+offset+3,blockdata.data() + offset + 4, &yloc);
-		std::copy(blockdata.data()+offset+4,blockdata.data() + offset + 5, reinterpret_cast<std::uint8_t*>(&altitude));
-		std::copy(blockdata.data()+offset+5,blockdata.data() + offset + 7, reinterpret_cast<std::uint8_t*>(&hue));
-		if ((static_cast<int>(xloc) == x) && (static_cast<int>(yloc) == y) && (static_cast<int>(altitude)==alt)){
-			rvalue.push_back(std::make_tuple(tileid,altitude,hue));
+	const auto *bytes = data() ;
+	for (std::size_t offset = 0 ; offset + 7 <= size() ; offset += 7){
+		if ((bytes[offset+2] == xloc) && (bytes[offset+3] == yloc) && (static_cast<int>(static_cast<std::int8_t>(bytes[offset+4]))==alt)){
+			rvalue.push_back(record(offset/7));
 		}
-		offset += 7 ;
 	}
 	return rvalue ;
 
@@ -184,18 +331,25 @@ auto artblock_t::remove(int x, int y) ->void {
 	auto temp = std::vector<std::uint8_t>() ;
 	auto xloc = std::uint8_t(0) ;
 	auto yloc = std::uint8_t(0) ;
-	auto offset = 0 ;
-	while (offset < blockdata.size()){
-		std::copy(blockdata.data()+offset+2,blockdata.data()+offset+3,&xloc) ;
-		std::copy(blockdata.data()+offset+3,blockdata.data()+offset+4,&xloc) ;
+	const auto *bytes = data() ;
+	std::size_t offset = 0 ;
+	while (offset < size()){
+		std::copy(bytes+offset+2,bytes+offset+3,&xloc) ;
+		std::copy(bytes+offset+3,bytes+offset+4,&yloc) ;
 		if ((static_cast<int>(xloc) != x) || (static_cast<int>(yloc) != y)){
 			auto size = temp.size() ;
 			temp.resize(size+7) ;
-			std::copy(blockdata.data()+offset,blockdata.data()+offset+7,temp.data()+size);
+			std::copy(bytes+offset,bytes+offset+7,temp.data()+size);
 		}
 		offset += 7 ;
 	}
 	blockdata = temp ;
+	viewdata = nullptr ;
+	viewsize = 0 ;
+	if (index != nullptr){
+		// Record numbers have shifted, so rebuild
+		buildIndex();
+	}
 }
 //================================================================================
 auto artblock_t::remove(int x, int y,int alt) ->void {
@@ -203,17 +357,102 @@ auto artblock_t::remove(int x, int y,int alt) ->void {
 	auto xloc = std::uint8_t(0) ;
 	auto yloc = std::uint8_t(0) ;
 	auto zloc = std::int8_t(0) ;
-	auto offset = 0 ;
-	while (offset < blockdata.size()){
-		std::copy(blockdata.data()+offset+2,blockdata.data()+offset+3,&xloc) ;
-		std::copy(blockdata.data()+offset+3,blockdata.data()+offset+4,&yloc) ;
-		std::copy(blockdata.data()+offset+4,blockdata.data()+offset+5,reinterpret_cast<std::uint8_t*>(&zloc)) ;
+	const auto *bytes = data() ;
+	std::size_t offset = 0 ;
+	while (offset < size()){
+		std::copy(bytes+offset+2,bytes+offset+3,&xloc) ;
+		std::copy(bytes+offset+3,bytes+offset+4,&yloc) ;
+		std::copy(bytes+offset+4,bytes+offset+5,reinterpret_cast<std::uint8_t*>(&zloc)) ;
 		if ((static_cast<int>(xloc) != x) || (static_cast<int>(yloc) != y) || (static_cast<int>(zloc) != alt)){
 			auto size = temp.size() ;
 			temp.resize(size+7) ;
-			std::copy(blockdata.data()+offset,blockdata.data()+offset+7,temp.data()+size);
+			std::copy(bytes+offset,bytes+offset+7,temp.data()+size);
 		}
 		offset += 7 ;
 	}
 	blockdata = temp ;
+	viewdata = nullptr ;
+	viewsize = 0 ;
+	if (index != nullptr){
+		// Record numbers have shifted, so rebuild
+		buildIndex();
+	}
+}
+//================================================================================
+auto artblock_t::cells(std::vector<artrecord_t> &records, artcells_t &offsets) const ->void {
+	auto base = static_cast<std::uint32_t>(records.size()) ;
+	offsets.fill(0) ;
+	const auto *bytes = data() ;
+	auto count = size()/7 ;
+	// Count each cell, then turn the counts into starting offsets
+	for (std::size_t i = 0 ; i < count ; ++i){
+		auto xloc = bytes[i*7+2] ;
+		auto yloc = bytes[i*7+3] ;
+		if ((xloc < 8) && (yloc < 8)){
+			offsets[yloc*8 + xloc + 1]++ ;
+		}
+	}
+	offsets[0] = base ;
+	for (auto cell = 1 ; cell < 65 ; ++cell){
+		offsets[cell] += offsets[cell-1] ;
+	}
+	records.resize(offsets[64]);
+	auto next = std::array<std::uint32_t,64>() ;
+	std::copy(offsets.begin(),offsets.begin()+64,next.begin());
+	for (std::size_t i = 0 ; i < count ; ++i){
+		const auto *record = bytes + i*7 ;
+		auto xloc = record[2] ;
+		auto yloc = record[3] ;
+		if ((xloc < 8) && (yloc < 8)){
+			auto &entry = records[next[yloc*8 + xloc]++] ;
+			std::copy(record,record+2,reinterpret_cast<std::uint8_t*>(&entry.tileid));
+			entry.altitude = static_cast<std::int8_t>(record[4]) ;
+			std::copy(record+5,record+7,reinterpret_cast<std::uint8_t*>(&entry.hue));
+		}
+	}
+}
+
+//=================================================================================
+//		Block summary
+//=================================================================================
+
+//=================================================================================
+blocksummary_t::blocksummary_t():terrainlow(0),terrainhigh(0),artlow(0),arthigh(0),artcount(0),terrainids(0),artids(0),terraincurrent(false),artcurrent(false){
+}
+//=================================================================================
+auto blocksummary_t::summarise(const terrainview_t &block) ->void {
+	auto low = 127 ;
+	auto high = -128 ;
+	terrainids = 0 ;
+	const auto *cell = block.data() + 4 ;
+	for (auto i = 0 ; i < 64 ; ++i, cell += 3){
+		auto tileid = std::uint16_t(0) ;
+		std::copy(cell,cell+2,reinterpret_cast<std::uint8_t*>(&tileid));
+		auto altitude = static_cast<int>(static_cast<std::int8_t>(cell[2])) ;
+		low = std::min(low, altitude) ;
+		high = std::max(high, altitude) ;
+		terrainids |= idbit(tileid) ;
+	}
+	terrainlow = static_cast<std::int8_t>(low) ;
+	terrainhigh = static_cast<std::int8_t>(high) ;
+	terraincurrent = true ;
+}
+//=================================================================================
+auto blocksummary_t::summarise(const artblock_t &block) ->void {
+	auto low = 127 ;
+	auto high = -128 ;
+	artids = 0 ;
+	artcount = static_cast<std::uint32_t>(block.size()/7) ;
+	const auto *record = block.data() ;
+	for (std::uint32_t i = 0 ; i < artcount ; ++i, record += 7){
+		auto tileid = std::uint16_t(0) ;
+		std::copy(record,record+2,reinterpret_cast<std::uint8_t*>(&tileid));
+		auto altitude = static_cast<int>(static_cast<std::int8_t>(record[4])) ;
+		low = std::min(low, altitude) ;
+		high = std::max(high, altitude) ;
+		artids |= idbit(tileid) ;
+	}
+	artlow = static_cast<std::int8_t>(low) ;
+	arthigh = static_cast<std::int8_t>(high) ;
+	artcurrent = true ;
 }
@@ -7,6 +7,8 @@
 #include <string>
 #include <utility>
 #include <tuple>
+#include <array>
+#include <memory>
 
 #include <vector>
 
@@ -14,24 +16,43 @@
 //		Terrain type structures
 //=================================================================================
 //=================================================================================
+// A view of one terrain block (the 196 byte mul layout: a 4 byte header, then
+// 64 cells of tileid(2)/altitude(1), cell = y*8+x).  It does not own the data,
+// the blocks live in their owner's storage (see uomap_t), so a view must not
+// outlive that storage.
 class terrainblock_t {
 	
-	std::vector<std::uint8_t> blockdata ;
+	std::uint8_t *blockdata ;
 	
 public:
-	terrainblock_t(std::int32_t blockheader) ;
-	terrainblock_t(const std::uint8_t* data = nullptr);
+	static constexpr std::size_t blocksize = 196 ;
+	
+	terrainblock_t(std::uint8_t* data = nullptr);
 	
 	auto header() const ->std::int32_t ;
 	auto header(std::int32_t value) ->void;
 
-	auto raw() const -> const std::vector<std::uint8_t>& ;
-	auto raw()  -> std::vector<std::uint8_t>& ;
+	auto data() const -> const std::uint8_t* ;
+	auto data()  -> std::uint8_t* ;
 
 	auto terrain(int x, int y) const -> std::pair<std::uint16_t,std::int8_t> ;
 	auto terrain(int x, int y, std::uint16_t tileid, std::int8_t altitude) ->void ;
 	auto fill(std::uint16_t tileid, std::int8_t altitude) ->void ;
 };
+//=================================================================================
+// The same view, read only, for blocks handed out by a const owner
+class terrainview_t {
+	
+	const std::uint8_t *blockdata ;
+	
+public:
+	terrainview_t(const std::uint8_t* data = nullptr);
+	terrainview_t(const terrainblock_t &block);
+	
+	auto header() const ->std::int32_t ;
+	auto data() const -> const std::uint8_t* ;
+	auto terrain(int x, int y) const -> std::pair<std::uint16_t,std::int8_t> ;
+};
 
 //=================================================================================
 //		Art type structures
@@ -39,24 +60,106 @@ public:
 
 
 //=================================================================================
+// One static, as handed out by the block/tile visitors
+struct artrecord_t {
+	std::uint16_t tileid ;
+	std::int8_t altitude ;
+	std::uint16_t hue ;
+};
+//=================================================================================
+// Statics of a block grouped by cell (cell = y*8 + x).  The records for a cell
+// are records[offsets[cell]] to records[offsets[cell+1]], in block order.
+using artcells_t = std::array<std::uint32_t,65> ;
+
+//=================================================================================
+// The records of a block are either its own (blockdata), or a shared view
+// into the owner's packed statics store (viewdata/viewsize, see uomap_t).
+// A shared block is copied into blockdata on its first change.
 class artblock_t {
 	std::vector<std::uint8_t> blockdata ;
+	const std::uint8_t *viewdata ;
+	std::uint32_t viewsize ;
+	
+	//=============================================================================
+	// Optional per cell index (CSR).  order holds record numbers (offset/7),
+	// grouped by cell (y*8+x), and by altitude within a cell (file order for
+	// equal altitudes).  The records for a cell are order[offsets[cell]] to
+	// order[offsets[cell+1]].
+	struct artindex_t {
+		artcells_t offsets ;
+		std::vector<std::uint16_t> order ;
+	};
+	std::unique_ptr<artindex_t> index ;
+	
+	auto record(std::size_t number) const ->std::tuple<std::uint16_t,std::int8_t,std::uint16_t> ;
+	auto detach() ->void ;
 	
 public:
 	artblock_t(const std::uint8_t *data, size_t size) ;
 	artblock_t() ;
+	artblock_t(const artblock_t &value) ;
+	auto operator=(const artblock_t &value) ->artblock_t& ;
+	artblock_t(artblock_t &&value) = default ;
+	auto operator=(artblock_t &&value) ->artblock_t& = default ;
 	
 	auto size() const ->size_t ;
 	
-	auto raw() const -> const std::vector<std::uint8_t>& ;
+	auto data() const -> const std::uint8_t* ;
+	// Mutable access gives the block its own copy, and drops the index (we
+	// can't tell what the caller changes), call buildIndex() again once done
 	auto raw()  -> std::vector<std::uint8_t>& ;
 	auto clear() ->void ;
+	// Share size bytes of records at data (which must outlive the block, or
+	// the next view/clear/change of it)
+	auto view(const std::uint8_t *data, size_t size) ->void ;
+	auto shared() const ->bool ;
+	
+	// With an index, art(x,y) returns the cell in altitude order, and art(x,y,alt)
+	// is a binary search of the cell.  Without, both scan the block in file order.
+	auto buildIndex() ->void ;
+	auto dropIndex() ->void ;
+	auto indexed() const ->bool ;
 	
 	auto art(int x, int y, std::uint16_t tileid, std::int8_t altitude, std::uint16_t hue =0 ) ->void ;
 	auto art(int x, int y) const -> std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>> ;
 	auto art(int x, int y,int alt) const -> std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>> ;
 	auto remove(int x, int y) ->void ;
 	auto remove(int x, int y,int alt) ->void ;
+	// One pass over the block, appending its records to records grouped by cell,
+	// offsets are into records (so several blocks can share one vector)
+	auto cells(std::vector<artrecord_t> &records, artcells_t &offsets) const ->void ;
+};
+
+//=================================================================================
+//		Block summary
+//=================================================================================
+
+//=================================================================================
+// What a block holds, in brief, so a search can pass over the blocks that
+// can't have what it wants without reading them.  The ids are a 64 bit filter
+// (ids share bits), so a clear bit means the id isn't there, a set one that
+// it may be.
+struct blocksummary_t {
+	std::int8_t terrainlow ;
+	std::int8_t terrainhigh ;
+	std::int8_t artlow ;			// Of the statics, when artcount > 0
+	std::int8_t arthigh ;
+	std::uint32_t artcount ;
+	std::uint64_t terrainids ;
+	std::uint64_t artids ;
+	bool terraincurrent ;			// Each half is worked out again when not
+	bool artcurrent ;
+
+	blocksummary_t() ;
+	static auto idbit(std::uint16_t id) ->std::uint64_t {return std::uint64_t(1) << ((id ^ (id >> 6)) & 63);}
+	auto summarise(const terrainview_t &block) ->void ;
+	auto summarise(const artblock_t &block) ->void ;
+
+	auto terrainMayHave(std::uint16_t id) const ->bool {return (terrainids & idbit(id)) != 0;}
+	auto artMayHave(std::uint16_t id) const ->bool {return (artids & idbit(id)) != 0;}
+	// Whether anything could be from low to high (inclusive)
+	auto terrainBetween(int low, int high) const ->bool {return (terrainhigh >= low) && (terrainlow <= high);}
+	auto artBetween(int low, int high) const ->bool {return (artcount > 0) && (arthigh >= low) && (artlow <= high);}
 };
 
 #endif /* mapblock_hpp */
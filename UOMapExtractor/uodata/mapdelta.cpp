@@ -0,0 +1,31 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "mapdelta.hpp"
+#include "listwriter.hpp"
+
+//=================================================================================
+auto mapdelta_t::write(const uomap_t &before, const uomap_t &after, const std::string &filepath, stats_t *stats) ->bool {
+	if ((before.size() != after.size()) || (before.map() != after.map())){
+		return false ;
+	}
+	auto output = listwriter_t(filepath) ;
+	if (!output.is_open()){
+		return false ;
+	}
+	output << "//Changes to map " << after.map() << '\n';
+	output << "msg Updating map " << after.map() << '\n';
+	auto result = compare(before, after, [&output](int x, int y, std::uint16_t tileid, std::int8_t altitude){
+		output<<"add terrain,"<<x<<','<<y<<',' ;
+		output.hex(tileid,4)<<','<<static_cast<int>(altitude)<<'\n';
+	}, [&output](int x, int y, const artrecord_t *first, const artrecord_t *last){
+		output<<"remove art,"<<x<<','<<y<<'\n' ;
+		for (const auto *cell = first ; cell != last ; ++cell){
+			output<<"add art,"<<x<<','<<y<<',' ;
+			output.hex(cell->tileid,4)<<','<<static_cast<int>(cell->altitude)<<','<<cell->hue<<'\n';
+		}
+	});
+	if (stats != nullptr){
+		*stats = result ;
+	}
+	return output.close() ;
+}
@@ -0,0 +1,92 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef mapdelta_hpp
+#define mapdelta_hpp
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "uomap.hpp"
+
+/*
+ The difference between two versions of a map (before and after a patch, say),
+ as the commands that turn the first into the second:
+ 	add terrain,x,y,tileid,altitude		for a tile whose terrain changed
+ 	remove art,x,y						for a tile whose statics changed, followed by
+ 	add art,x,y,tileid,altitude,hue		for each of its new statics (none if they were removed)
+ Blocks are compared whole first (raw bytes), so only the blocks that changed
+ are looked at tile by tile.
+ */
+//=================================================================================
+class mapdelta_t {
+public:
+	struct stats_t {
+		std::uint64_t blocks = 0 ;			// that changed
+		std::uint64_t terrain = 0 ;			// tiles with changed terrain
+		std::uint64_t art = 0 ;				// tiles with changed statics
+	};
+
+	//=============================================================================
+	// terrain(x, y, tileid, altitude) for each tile whose terrain changed, and
+	// art(x, y, const artrecord_t *first, const artrecord_t *last) for each tile
+	// whose statics changed (first to last are its statics in after), in
+	// block order.
+	template <typename Terrain, typename Art>
+	static auto compare(const uomap_t &before, const uomap_t &after, Terrain &&terrain, Art &&art) ->stats_t {
+		auto stats = stats_t() ;
+		auto beforerecords = std::vector<artrecord_t>() ;
+		auto afterrecords = std::vector<artrecord_t>() ;
+		auto beforecells = artcells_t() ;
+		auto aftercells = artcells_t() ;
+		before.forEachBlockWith(after, [&](int xbase, int ybase, const terrainview_t &oldterrain, const artblock_t &oldart, const terrainview_t &newterrain, const artblock_t &newart){
+			// The header isn't part of the map
+			auto terrainsame = std::memcmp(oldterrain.data()+4, newterrain.data()+4, terrainblock_t::blocksize-4) == 0 ;
+			auto artsame = (oldart.size() == newart.size()) && ((oldart.size() == 0) || (std::memcmp(oldart.data(), newart.data(), oldart.size()) == 0)) ;
+			if (terrainsame && artsame){
+				return ;
+			}
+			++stats.blocks ;
+			if (!terrainsame){
+				for (auto y = 0 ; y < 8 ; ++y){
+					for (auto x = 0 ; x < 8 ; ++x){
+						auto value = newterrain.terrain(x, y) ;
+						if (value != oldterrain.terrain(x, y)){
+							++stats.terrain ;
+							terrain(xbase+x, ybase+y, value.first, value.second);
+						}
+					}
+				}
+			}
+			if (!artsame){
+				beforerecords.clear();
+				afterrecords.clear();
+				oldart.cells(beforerecords, beforecells);
+				newart.cells(afterrecords, aftercells);
+				for (auto cell = 0 ; cell < 64 ; ++cell){
+					const auto *first = afterrecords.data() + aftercells[cell] ;
+					const auto *last = afterrecords.data() + aftercells[cell+1] ;
+					const auto *oldfirst = beforerecords.data() + beforecells[cell] ;
+					auto count = static_cast<std::size_t>(last - first) ;
+					auto same = (count == beforecells[cell+1] - beforecells[cell]) ;
+					for (std::size_t i = 0 ; same && (i < count) ; ++i){
+						same = (first[i].tileid == oldfirst[i].tileid) && (first[i].altitude == oldfirst[i].altitude) && (first[i].hue == oldfirst[i].hue) ;
+					}
+					if (!same){
+						++stats.art ;
+						art(xbase + cell%8, ybase + cell/8, first, last);
+					}
+				}
+			}
+		});
+		return stats ;
+	}
+
+	//=============================================================================
+	// The commands, as a command list.  False if the maps aren't the same size,
+	// or the file can't be written.
+	static auto write(const uomap_t &before, const uomap_t &after, const std::string &filepath, stats_t *stats = nullptr) ->bool ;
+};
+
+#endif /* mapdelta_hpp */
@@ -0,0 +1,138 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "radarmap.hpp"
+#include "parallel.hpp"
+#include "strutil.hpp"
+
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <limits>
+#include <atomic>
+#include <tuple>
+
+//=================================================================================
+radarmap_t::radarmap_t():width(0),height(0) {
+}
+
+//=================================================================================
+auto radarmap_t::loadColors(const std::string &filepath) ->bool {
+	auto input = std::ifstream(filepath,std::ios::binary) ;
+	if (!input.is_open()){
+		return false ;
+	}
+	input.seekg(0,std::ios::end);
+	auto filesize = static_cast<std::size_t>(input.tellg()) ;
+	input.seekg(0,std::ios::beg);
+	colors.resize(filesize/2);
+	input.read(reinterpret_cast<char*>(colors.data()),static_cast<std::streamsize>(colors.size()*2));
+	if (static_cast<std::size_t>(input.gcount()) != colors.size()*2){
+		colors.clear();
+		return false ;
+	}
+	return true ;
+}
+
+//=================================================================================
+auto radarmap_t::render(const uomap_t &map, int tilesize, unsigned int jobs) ->void {
+	std::tie(width,height) = map.size() ;
+	pixels.assign(static_cast<std::size_t>(width) * static_cast<std::size_t>(height) * 3, 0);
+	// Whole blocks to a tile, so no two tiles share a block
+	tilesize = std::max(8, (tilesize/8)*8) ;
+	auto across = (width + tilesize - 1) / tilesize ;
+	auto down = (height + tilesize - 1) / tilesize ;
+	auto setPixel = [this](int x, int y, std::uint16_t color){
+		auto *pixel = pixels.data() + (static_cast<std::size_t>(y)*width + x)*3 ;
+		pixel[0] = static_cast<std::uint8_t>((((color >> 10) & 0x1F) * 255) / 31) ;
+		pixel[1] = static_cast<std::uint8_t>((((color >> 5) & 0x1F) * 255) / 31) ;
+		pixel[2] = static_cast<std::uint8_t>(((color & 0x1F) * 255) / 31) ;
+	};
+	parallel::forEach(static_cast<std::size_t>(across) * down, map.lazy() ? 1 : jobs, [&](std::size_t tile){
+		auto x0 = static_cast<int>(tile % across) * tilesize ;
+		auto y0 = static_cast<int>(tile / across) * tilesize ;
+		auto x1 = std::min(x0 + tilesize, width) - 1 ;
+		auto y1 = std::min(y0 + tilesize, height) - 1 ;
+		auto tilewidth = x1 - x0 + 1 ;
+		// The altitude of the static showing on each tile so far
+		auto top = std::vector<int>(static_cast<std::size_t>(tilewidth) * (y1 - y0 + 1), std::numeric_limits<int>::min()) ;
+		map.forEachTerrainIn(x0, y0, x1, y1, [&](int x, int y, std::uint16_t tileid, std::int8_t){
+			setPixel(x, y, color(tileid));
+		});
+		map.forEachArtIn(x0, y0, x1, y1, [&](int x, int y, const artrecord_t &record){
+			auto &highest = top[static_cast<std::size_t>(y - y0)*tilewidth + (x - x0)] ;
+			if (record.altitude >= highest){
+				highest = record.altitude ;
+				setPixel(x, y, color(staticbase + record.tileid));
+			}
+		});
+	});
+}
+
+//=================================================================================
+auto radarmap_t::writeTile(const std::string &filepath, const std::uint8_t *image, int imagewidth, int x, int y, int tilewidth, int tileheight) ->bool {
+	auto output = std::ofstream(filepath,std::ios::binary) ;
+	if (!output.is_open()){
+		return false ;
+	}
+	output << "P6\n" << tilewidth << ' ' << tileheight << "\n255\n" ;
+	for (auto row = y ; row < y + tileheight ; ++row){
+		output.write(reinterpret_cast<const char*>(image + (static_cast<std::size_t>(row)*imagewidth + x)*3),static_cast<std::streamsize>(tilewidth)*3);
+	}
+	return output.good() ;
+}
+
+//=================================================================================
+auto radarmap_t::write(const std::string &directory, const std::string &name, int tilesize, unsigned int jobs, int *levels) const ->bool {
+	tilesize = std::max(tilesize, 1) ;
+	auto failed = std::atomic<bool>(false) ;
+	auto level = 0 ;
+	auto levelwidth = width ;
+	auto levelheight = height ;
+	const auto *image = pixels.data() ;
+	auto reduced = std::vector<std::uint8_t>() ;
+	auto next = std::vector<std::uint8_t>() ;
+	while ((levelwidth > 0) && (levelheight > 0) && !failed){
+		auto across = (levelwidth + tilesize - 1) / tilesize ;
+		auto down = (levelheight + tilesize - 1) / tilesize ;
+		parallel::forEach(static_cast<std::size_t>(across) * down, jobs, [&](std::size_t tile){
+			auto column = static_cast<int>(tile % across) ;
+			auto row = static_cast<int>(tile / across) ;
+			auto x = column * tilesize ;
+			auto y = row * tilesize ;
+			auto filepath = (std::filesystem::path(directory) / strutil::format("%s_%i_%i_%i.ppm", name.c_str(), level, column, row)).string() ;
+			if (!writeTile(filepath, image, levelwidth, x, y, std::min(tilesize, levelwidth - x), std::min(tilesize, levelheight - y))){
+				failed = true ;
+			}
+		});
+		++level ;
+		if ((levelwidth <= tilesize) && (levelheight <= tilesize)){
+			break ;
+		}
+		// Each pixel of the next level is the average of the (up to) four
+		// under it
+		auto nextwidth = (levelwidth + 1) / 2 ;
+		auto nextheight = (levelheight + 1) / 2 ;
+		next.resize(static_cast<std::size_t>(nextwidth) * nextheight * 3);
+		parallel::forEach(static_cast<std::size_t>(nextheight), jobs, [&](std::size_t y){
+			auto top = static_cast<int>(y) * 2 ;
+			auto bottom = std::min(top + 1, levelheight - 1) ;
+			for (auto x = 0 ; x < nextwidth ; ++x){
+				auto left = x * 2 ;
+				auto right = std::min(left + 1, levelwidth - 1) ;
+				for (auto channel = 0 ; channel < 3 ; ++channel){
+					auto sum = image[(static_cast<std::size_t>(top)*levelwidth + left)*3 + channel] + image[(static_cast<std::size_t>(top)*levelwidth + right)*3 + channel] ;
+					sum += image[(static_cast<std::size_t>(bottom)*levelwidth + left)*3 + channel] + image[(static_cast<std::size_t>(bottom)*levelwidth + right)*3 + channel] ;
+					next[(y*nextwidth + x)*3 + channel] = static_cast<std::uint8_t>((sum + 2) / 4) ;
+				}
+			}
+		});
+		reduced.swap(next);
+		image = reduced.data() ;
+		levelwidth = nextwidth ;
+		levelheight = nextheight ;
+	}
+	if (levels != nullptr){
+		*levels = level ;
+	}
+	return !failed ;
+}
@@ -0,0 +1,53 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef radarmap_hpp
+#define radarmap_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "uomap.hpp"
+
+/*
+ An overview (radar) image of a map, a pixel per tile, coloured from
+ radarcol.mul (ARGB1555, terrain tile ids first, then statics at 0x4000 +
+ tileid).  A tile shows its highest static (the last of equal altitude, in
+ block order), or its terrain if it has none.
+
+ The image is written as a pyramid of levels, each half the size of the one
+ before (1:1, 1:2, 1:4, ... until it fits in one tile), cut into binary PPM
+ tiles:
+ 	directory/name_level_column_row.ppm
+ so a viewer only has to read the part (and detail) it shows.
+ */
+//=================================================================================
+class radarmap_t {
+	std::vector<std::uint16_t> colors ;
+	int width ;
+	int height ;
+	std::vector<std::uint8_t> pixels ;		// RGB, row major
+
+	auto color(std::size_t index) const ->std::uint16_t {return (index < colors.size()) ? colors[index] : 0;}
+	static auto writeTile(const std::string &filepath, const std::uint8_t *image, int imagewidth, int x, int y, int tilewidth, int tileheight) ->bool ;
+
+public:
+	static constexpr auto staticbase = std::size_t(0x4000) ;
+	radarmap_t() ;
+	auto loadColors(const std::string &filepath) ->bool ;
+
+	//=============================================================================
+	// Tiles of tilesize square are rendered at once, on up to jobs threads (0
+	// is one per hardware thread).  A lazy map is read in through its cache,
+	// which is one thread only, so is rendered on this one.
+	auto render(const uomap_t &map, int tilesize = 256, unsigned int jobs = 0) ->void ;
+	auto size() const ->std::pair<int,int> {return std::make_pair(width,height);}
+	auto image() const ->const std::vector<std::uint8_t>& {return pixels;}
+
+	// The pyramid, false if a tile can't be written.  The number of levels
+	// written is in levels, if given.
+	auto write(const std::string &directory, const std::string &name, int tilesize = 256, unsigned int jobs = 0, int *levels = nullptr) const ->bool ;
+};
+
+#endif /* radarmap_hpp */
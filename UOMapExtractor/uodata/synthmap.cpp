@@ -0,0 +1,154 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "synthmap.hpp"
+#include "uomap.hpp"
+#include "strutil.hpp"
+
+#include <fstream>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+constexpr auto watertile = std::uint16_t(0xA8) ;
+constexpr auto wateraltitude = std::int8_t(-5) ;
+constexpr auto patchblocks = 16 ;		// Land and water come in patches this many blocks across
+
+//=================================================================================
+// The data out in one write
+static auto writeFile(const std::filesystem::path &path, const std::vector<std::uint8_t> &data) ->std::uint64_t {
+	auto output = std::ofstream(path.string(),std::ios::binary) ;
+	if (!output.is_open()){
+		return 0 ;
+	}
+	output.write(reinterpret_cast<const char*>(data.data()),static_cast<std::streamsize>(data.size()));
+	return output.good() ? static_cast<std::uint64_t>(data.size()) : 0 ;
+}
+//=================================================================================
+static auto put(std::vector<std::uint8_t> &data, const void *value, std::size_t size) ->void {
+	const auto *bytes = static_cast<const std::uint8_t*>(value) ;
+	data.insert(data.end(), bytes, bytes + size);
+}
+//=================================================================================
+// A random static for cell x,y of a block, standing on altitude
+static auto addStatic(std::vector<std::uint8_t> &data, std::mt19937 &rng, int x, int y, int altitude) ->void {
+	auto tileid = static_cast<std::uint16_t>(rng() % 0x4000) ;
+	auto z = static_cast<std::int8_t>(std::min(altitude + static_cast<int>(rng() % 20), 127)) ;
+	auto hue = static_cast<std::uint16_t>(((rng() % 4) == 0) ? (rng() % 0x400) : 0) ;
+	put(data, &tileid, 2);
+	data.push_back(static_cast<std::uint8_t>(x));
+	data.push_back(static_cast<std::uint8_t>(y));
+	data.push_back(static_cast<std::uint8_t>(z));
+	put(data, &hue, 2);
+}
+
+//=================================================================================
+auto synthmap_t::generate(const std::filesystem::path &directory, int mapnum, const options_t &options) ->std::uint64_t {
+	auto [width,height] = uomap_t::defaultSize(mapnum) ;
+	auto blocksacross = width/8 ;
+	auto blocksdown = height/8 ;
+	auto blocks = static_cast<std::size_t>(blocksacross) * blocksdown ;
+	auto rng = std::mt19937(options.seed + static_cast<std::uint32_t>(mapnum)) ;
+	auto patchrng = std::mt19937(options.seed) ;
+	auto patches = std::vector<bool>(static_cast<std::size_t>(blocksacross/patchblocks + 1) * (blocksdown/patchblocks + 1)) ;
+	for (auto patch = std::size_t(0) ; patch < patches.size() ; ++patch){
+		patches[patch] = (patchrng() % 3) != 0 ;
+	}
+	auto land = [&](int blockx, int blocky){
+		return patches[static_cast<std::size_t>(blockx/patchblocks) * (blocksdown/patchblocks + 1) + blocky/patchblocks] ;
+	};
+
+	// Terrain, in the mul layout, and the statics on it
+	auto terrain = std::vector<std::uint8_t>(blocks * terrainblock_t::blocksize, 0) ;
+	auto idx = std::vector<std::uint8_t>() ;
+	auto statics = std::vector<std::uint8_t>() ;
+	idx.reserve(blocks * 12);
+	auto record = std::vector<std::uint8_t>() ;
+	for (auto blockx = 0 ; blockx < blocksacross ; ++blockx){
+		for (auto blocky = 0 ; blocky < blocksdown ; ++blocky){
+			auto block = static_cast<std::size_t>(blockx) * blocksdown + blocky ;
+			auto *cell = terrain.data() + block * terrainblock_t::blocksize + 4 ;
+			auto island = land(blockx, blocky) ;
+			auto basetile = static_cast<std::uint16_t>(3 + rng() % 0x200) ;
+			record.clear();
+			for (auto y = 0 ; y < 8 ; ++y){
+				for (auto x = 0 ; x < 8 ; ++x, cell += 3){
+					auto tileid = watertile ;
+					auto altitude = static_cast<int>(wateraltitude) ;
+					if (island){
+						tileid = static_cast<std::uint16_t>(basetile + rng() % 4) ;
+						altitude = ((blockx*8 + x)/16 + (blocky*8 + y)/16) % 40 + static_cast<int>(rng() % 3) ;
+						auto count = options.density / 100 + ((static_cast<int>(rng() % 100) < options.density % 100) ? 1 : 0) ;
+						for (auto i = 0 ; i < count ; ++i){
+							addStatic(record, rng, x, y, altitude);
+						}
+					}
+					std::memcpy(cell, &tileid, 2);
+					cell[2] = static_cast<std::uint8_t>(static_cast<std::int8_t>(altitude)) ;
+				}
+			}
+			auto offset = static_cast<std::uint32_t>(record.empty() ? 0xFFFFFFFF : statics.size()) ;
+			auto length = static_cast<std::uint32_t>(record.size()) ;
+			auto extra = std::uint32_t(0) ;
+			put(idx, &offset, 4);
+			put(idx, &length, 4);
+			put(idx, &extra, 4);
+			statics.insert(statics.end(), record.begin(), record.end());
+		}
+	}
+
+	// The diff, some blocks given new statics (or none)
+	auto difl = std::vector<std::uint8_t>() ;
+	auto difi = std::vector<std::uint8_t>() ;
+	auto dif = std::vector<std::uint8_t>() ;
+	auto diffcount = blocks * static_cast<std::size_t>(options.diffblocks) / 1000 ;
+	auto listed = std::vector<std::uint32_t>() ;
+	for (std::size_t entry = 0 ; entry < diffcount ; ++entry){
+		// Every tenth one goes over one from before
+		auto block = (entry % 10 == 9) ? listed[entry/2] : static_cast<std::uint32_t>(rng() % blocks) ;
+		listed.push_back(block);
+		record.clear();
+		if ((rng() % 8) != 0){
+			auto count = 1 + rng() % 8 ;
+			for (auto i = 0u ; i < count ; ++i){
+				addStatic(record, rng, static_cast<int>(rng() % 8), static_cast<int>(rng() % 8), static_cast<int>(rng() % 40));
+			}
+		}
+		auto offset = static_cast<std::uint32_t>(record.empty() ? 0xFFFFFFFF : dif.size()) ;
+		auto length = static_cast<std::uint32_t>(record.size()) ;
+		auto extra = std::uint32_t(0) ;
+		put(difl, &block, 4);
+		put(difi, &offset, 4);
+		put(difi, &length, 4);
+		put(difi, &extra, 4);
+		dif.insert(dif.end(), record.begin(), record.end());
+	}
+
+	auto path = [&directory, mapnum](const char *format){
+		return directory / std::filesystem::path(strutil::format(format, mapnum)) ;
+	};
+	auto written = std::uint64_t(0) ;
+	auto files = {
+		std::make_pair(path("map%i.mul"), &terrain),
+		std::make_pair(path("staidx%i.mul"), &idx), std::make_pair(path("statics%i.mul"), &statics),
+		std::make_pair(path("stadifl%i.mul"), &difl), std::make_pair(path("stadifi%i.mul"), &difi), std::make_pair(path("stadif%i.mul"), &dif)
+	};
+	for (const auto &[filepath, data] : files){
+		auto amount = writeFile(filepath, *data) ;
+		if ((amount == 0) && !data->empty()){
+			return 0 ;
+		}
+		written += amount ;
+	}
+	// The uop is the same terrain, so it is just written out by a map
+	std::vector<std::uint8_t>().swap(terrain);
+	auto uomap = uomap_t(mapnum) ;
+	auto uop = path("map%iLegacyMUL.uop") ;
+	if (!uomap.loadTerrainMul(path("map%i.mul")) || !uomap.writeTerrainUOP(uop.string())){
+		return 0 ;
+	}
+	auto error = std::error_code() ;
+	written += static_cast<std::uint64_t>(std::filesystem::file_size(uop, error)) ;
+	return written ;
+}
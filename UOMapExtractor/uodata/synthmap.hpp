@@ -0,0 +1,30 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef synthmap_hpp
+#define synthmap_hpp
+
+#include <cstdint>
+#include <filesystem>
+
+/*
+ A made up client map, for when there is no client to hand (benchmarks, CI).
+ For a map number (and its default size), writes to a directory:
+ 	map%i.mul, map%iLegacyMUL.uop			terrain
+ 	staidx%i.mul, statics%i.mul				statics
+ 	stadifl%i.mul, stadifi%i.mul, stadif%i.mul	statics diffs
+ The land comes in patches, with open water (no statics) between them, so it
+ has some of the shape of a real map.  The same seed always makes the same
+ files.
+ */
+//=================================================================================
+struct synthmap_t {
+	struct options_t {
+		int density = 25 ;				// Statics per 100 land tiles
+		int diffblocks = 10 ;			// Blocks in the diff per 1000 (some listed twice)
+		std::uint32_t seed = 1 ;
+	};
+	// The bytes written, 0 if a file couldn't be
+	static auto generate(const std::filesystem::path &directory, int mapnum, const options_t &options) ->std::uint64_t ;
+};
+
+#endif /* synthmap_hpp */
@@ -0,0 +1,211 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "terrainplanes.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+
+// SSE2 is there on every x64 build, AVX2 only when the build targets it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define UOMAP_PLANES_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define UOMAP_PLANES_AVX2
+#include <immintrin.h>
+#endif
+
+constexpr auto bandrows = 16 ;
+constexpr auto maxvectorids = std::size_t(8) ;
+
+//=================================================================================
+// The set bits of mask (bit n is tile base+n)
+static auto addFound(std::uint32_t mask, std::size_t base, std::vector<std::uint32_t> &found) ->void {
+	for (auto bit = std::uint32_t(0) ; mask != 0 ; ++bit, mask >>= 1){
+		if ((mask & 1) != 0){
+			found.push_back(static_cast<std::uint32_t>(base + bit));
+		}
+	}
+}
+
+//=================================================================================
+terrainplanes_t::terrainplanes_t():width(0),height(0) {
+}
+//=================================================================================
+terrainplanes_t::terrainplanes_t(const uomap_t &map):terrainplanes_t() {
+	build(map);
+}
+//=================================================================================
+auto terrainplanes_t::build(const uomap_t &map) ->void {
+	std::tie(width,height) = map.size() ;
+	auto tiles = static_cast<std::size_t>(width) * static_cast<std::size_t>(height) ;
+	tileids.resize(tiles);
+	altitudes.resize(tiles);
+	map.forEachTerrainIn(0, 0, width - 1, height - 1, [this](int x, int y, std::uint16_t tileid, std::int8_t altitude){
+		auto location = index(x, y) ;
+		tileids[location] = tileid ;
+		altitudes[location] = altitude ;
+	});
+}
+//=================================================================================
+auto terrainplanes_t::clear() ->void {
+	width = 0 ;
+	height = 0 ;
+	std::vector<std::uint16_t>().swap(tileids);
+	std::vector<std::int8_t>().swap(altitudes);
+}
+
+//=================================================================================
+template <typename Scan>
+auto terrainplanes_t::scanBands(std::vector<std::uint32_t> &found, Scan &&scan) const ->std::size_t {
+	found.clear();
+	auto bands = static_cast<std::size_t>((height + bandrows - 1) / bandrows) ;
+	auto bandfound = std::vector<std::vector<std::uint32_t>>(bands) ;
+	parallel::forEach(bands, 0, [&](std::size_t band){
+		auto first = static_cast<std::size_t>(index(0, static_cast<int>(band) * bandrows)) ;
+		auto last = std::min(first + static_cast<std::size_t>(bandrows) * width, tileids.size()) ;
+		scan(first, last, bandfound[band]);
+	});
+	auto total = std::size_t(0) ;
+	for (const auto &entry : bandfound){
+		total += entry.size() ;
+	}
+	found.reserve(total);
+	for (const auto &entry : bandfound){
+		found.insert(found.end(), entry.begin(), entry.end());
+	}
+	return found.size() ;
+}
+
+//=================================================================================
+auto terrainplanes_t::findTiles(const std::vector<std::uint16_t> &ids, std::vector<std::uint32_t> &found) const ->std::size_t {
+	auto wanted = ids ;
+	std::sort(wanted.begin(), wanted.end());
+	wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+	if (wanted.empty()){
+		found.clear();
+		return 0 ;
+	}
+	if (wanted.size() > maxvectorids){
+		// Too many to compare against, so a lookup per tile
+		auto bits = std::vector<std::uint64_t>(0x10000/64, 0) ;
+		for (auto id : wanted){
+			bits[id/64] |= std::uint64_t(1) << (id%64) ;
+		}
+		return scanBands(found, [this, &bits](std::size_t first, std::size_t last, std::vector<std::uint32_t> &result){
+			const auto *tiles = tileids.data() ;
+			for (auto i = first ; i < last ; ++i){
+				if ((bits[tiles[i]/64] >> (tiles[i]%64)) & 1){
+					result.push_back(static_cast<std::uint32_t>(i));
+				}
+			}
+		});
+	}
+	// Unused slots repeat the first id, so every slot can be compared
+	wanted.resize(maxvectorids, wanted.front());
+	return scanBands(found, [this, &wanted](std::size_t first, std::size_t last, std::vector<std::uint32_t> &result){
+		const auto *tiles = tileids.data() ;
+		auto i = first ;
+#if defined(UOMAP_PLANES_AVX2)
+		__m256i keys[maxvectorids] ;
+		for (std::size_t k = 0 ; k < maxvectorids ; ++k){
+			keys[k] = _mm256_set1_epi16(static_cast<short>(wanted[k])) ;
+		}
+		for ( ; i + 32 <= last ; i += 32){
+			auto low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tiles + i)) ;
+			auto high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tiles + i + 16)) ;
+			auto hitlow = _mm256_setzero_si256() ;
+			auto hithigh = _mm256_setzero_si256() ;
+			for (std::size_t k = 0 ; k < maxvectorids ; ++k){
+				hitlow = _mm256_or_si256(hitlow, _mm256_cmpeq_epi16(low, keys[k])) ;
+				hithigh = _mm256_or_si256(hithigh, _mm256_cmpeq_epi16(high, keys[k])) ;
+			}
+			// A byte per tile (the pack works per 128 bit lane, the permute puts them back in order)
+			auto hits = _mm256_permute4x64_epi64(_mm256_packs_epi16(hitlow, hithigh), 0xD8) ;
+			addFound(static_cast<std::uint32_t>(_mm256_movemask_epi8(hits)), i, result);
+		}
+#endif
+#if defined(UOMAP_PLANES_SSE2)
+		__m128i keys16[maxvectorids] ;
+		for (std::size_t k = 0 ; k < maxvectorids ; ++k){
+			keys16[k] = _mm_set1_epi16(static_cast<short>(wanted[k])) ;
+		}
+		for ( ; i + 16 <= last ; i += 16){
+			auto low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tiles + i)) ;
+			auto high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tiles + i + 8)) ;
+			auto hitlow = _mm_setzero_si128() ;
+			auto hithigh = _mm_setzero_si128() ;
+			for (std::size_t k = 0 ; k < maxvectorids ; ++k){
+				hitlow = _mm_or_si128(hitlow, _mm_cmpeq_epi16(low, keys16[k])) ;
+				hithigh = _mm_or_si128(hithigh, _mm_cmpeq_epi16(high, keys16[k])) ;
+			}
+			addFound(static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(hitlow, hithigh))), i, result);
+		}
+#endif
+		for ( ; i < last ; ++i){
+			if (std::find(wanted.begin(), wanted.end(), tiles[i]) != wanted.end()){
+				result.push_back(static_cast<std::uint32_t>(i));
+			}
+		}
+	});
+}
+
+//=================================================================================
+auto terrainplanes_t::findAltitude(int low, int high, std::vector<std::uint32_t> &found) const ->std::size_t {
+	low = std::max(low, -128) ;
+	high = std::min(high, 127) ;
+	if (low > high){
+		found.clear();
+		return 0 ;
+	}
+	return scanBands(found, [this, low, high](std::size_t first, std::size_t last, std::vector<std::uint32_t> &result){
+		const auto *values = altitudes.data() ;
+		auto i = first ;
+#if defined(UOMAP_PLANES_AVX2)
+		const auto lowest = _mm256_set1_epi8(static_cast<char>(low)) ;
+		const auto highest = _mm256_set1_epi8(static_cast<char>(high)) ;
+		for ( ; i + 32 <= last ; i += 32){
+			auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i)) ;
+			auto outside = _mm256_or_si256(_mm256_cmpgt_epi8(lowest, value), _mm256_cmpgt_epi8(value, highest)) ;
+			addFound(~static_cast<std::uint32_t>(_mm256_movemask_epi8(outside)), i, result);
+		}
+#endif
+#if defined(UOMAP_PLANES_SSE2)
+		const auto lowest16 = _mm_set1_epi8(static_cast<char>(low)) ;
+		const auto highest16 = _mm_set1_epi8(static_cast<char>(high)) ;
+		for ( ; i + 16 <= last ; i += 16){
+			auto value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)) ;
+			auto outside = _mm_or_si128(_mm_cmpgt_epi8(lowest16, value), _mm_cmpgt_epi8(value, highest16)) ;
+			addFound(~static_cast<std::uint32_t>(_mm_movemask_epi8(outside)) & 0xFFFF, i, result);
+		}
+#endif
+		for ( ; i < last ; ++i){
+			if ((values[i] >= low) && (values[i] <= high)){
+				result.push_back(static_cast<std::uint32_t>(i));
+			}
+		}
+	});
+}
+
+//=================================================================================
+auto terrainplanes_t::countTiles(std::vector<std::uint64_t> &counts) const ->void {
+	// A count is a scatter, so no vectors here, just a histogram per thread
+	auto chunks = static_cast<std::size_t>(parallel::threads()) ;
+	auto chunksize = (tileids.size() + chunks - 1) / chunks ;
+	auto partial = std::vector<std::vector<std::uint32_t>>(chunks) ;
+	parallel::forEach(chunks, 0, [&](std::size_t chunk){
+		auto &histogram = partial[chunk] ;
+		histogram.assign(0x10000, 0);
+		auto first = std::min(chunk * chunksize, tileids.size()) ;
+		auto last = std::min(first + chunksize, tileids.size()) ;
+		for (auto i = first ; i < last ; ++i){
+			++histogram[tileids[i]] ;
+		}
+	});
+	counts.assign(0x10000, 0);
+	for (const auto &histogram : partial){
+		for (std::size_t id = 0 ; id < histogram.size() ; ++id){
+			counts[id] += histogram[id] ;
+		}
+	}
+}
@@ -0,0 +1,54 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef terrainplanes_hpp
+#define terrainplanes_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "uomap.hpp"
+
+/*
+ The terrain of a map pulled apart into two dense planes, the tile ids and the
+ altitudes, row major (index = y*width + x).  A snapshot, built from a map
+ (edits to the map after aren't seen), for scans over a whole map: they run
+ over contiguous memory, 16 (SSE2) or 32 (AVX2, when built for it) tiles at a
+ time, spread over the hardware threads.
+
+ Found tiles are their index in the planes, in index order.
+ */
+//=================================================================================
+class terrainplanes_t {
+	int width ;
+	int height ;
+	std::vector<std::uint16_t> tileids ;
+	std::vector<std::int8_t> altitudes ;
+
+	//=============================================================================
+	// Rows are handed out in bands, each band's finds kept apart and joined in
+	// order at the end
+	template <typename Scan>
+	auto scanBands(std::vector<std::uint32_t> &found, Scan &&scan) const ->std::size_t ;
+
+public:
+	terrainplanes_t() ;
+	explicit terrainplanes_t(const uomap_t &map) ;
+	auto build(const uomap_t &map) ->void ;
+	auto clear() ->void ;
+
+	auto size() const ->std::pair<int,int> {return std::make_pair(width,height);}
+	auto index(int x, int y) const ->std::uint32_t {return static_cast<std::uint32_t>(y)*static_cast<std::uint32_t>(width) + static_cast<std::uint32_t>(x);}
+	auto location(std::uint32_t index) const ->std::pair<int,int> {return std::make_pair(static_cast<int>(index % width),static_cast<int>(index / width));}
+	auto tileidPlane() const ->const std::vector<std::uint16_t>& {return tileids;}
+	auto altitudePlane() const ->const std::vector<std::int8_t>& {return altitudes;}
+
+	//=============================================================================
+	// The tiles whose id is in ids, the number found
+	auto findTiles(const std::vector<std::uint16_t> &ids, std::vector<std::uint32_t> &found) const ->std::size_t ;
+	// The tiles with an altitude from low to high (inclusive), the number found
+	auto findAltitude(int low, int high, std::vector<std::uint32_t> &found) const ->std::size_t ;
+	// How many tiles there are of each id (counts[tileid], 0x10000 of them)
+	auto countTiles(std::vector<std::uint64_t> &counts) const ->void ;
+};
+
+#endif /* terrainplanes_hpp */
@@ -2,16 +2,40 @@
 
 #include "uomap.hpp"
 #include "strutil.hpp"
+#include "parallel.hpp"
 
 #include <iostream>
 #include <stdexcept>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
 using namespace std::string_literals;
 
-constexpr auto uopblocksize= 4096 ;
+constexpr auto uopblocksize= uomap_t::sectionblocks ;
+// Below this many, a diff is applied on the calling thread, as starting the
+// threads costs more than copying the blocks
+constexpr auto parallelpatches = std::size_t(4096) ;
 
-static auto entrydata = std::vector<std::uint8_t>(uopblocksize*196,0) ;
+//=================================================================================
+// Diff patches (anything with a block and an offset into the diff data), the
+// last one listed for each block (a later one replaces an earlier one), in
+// order of where their data is.  Each is then a different block, so they can
+// be applied at the same time.
+template <typename Patch>
+static auto lastPerBlock(std::vector<Patch> &patches) ->void {
+	std::stable_sort(patches.begin(), patches.end(), [](const Patch &lhs, const Patch &rhs){
+		return lhs.block < rhs.block ;
+	});
+	auto last = std::unique(patches.rbegin(), patches.rend(), [](const Patch &lhs, const Patch &rhs){
+		return lhs.block == rhs.block ;
+	});
+	patches.erase(patches.begin(), last.base());
+	std::sort(patches.begin(), patches.end(), [](const Patch &lhs, const Patch &rhs){
+		return lhs.offset < rhs.offset ;
+	});
+}
 
 //=================================================================================
 auto uomap_t::calcBlock(int x, int y) const -> int {
@@ -34,16 +58,16 @@ auto uomap_t::calcBlockOffset(int x, int y) const -> std::tuple<int, int,int> {
 //  UOP methods
 
 //=================================================================================
-auto uomap_t::processEntry(std::size_t entry, std::size_t index, std::vector<std::uint8_t> &data) ->bool {
+auto uomap_t::processEntry(std::size_t entry, std::size_t index, const std::uint8_t *data, std::size_t size) ->bool {
 	//std::cout <<"Process Entry"<< std::endl;
+	// The entry is in the same layout as our storage, so it is one copy
 	auto startblock = index*uopblocksize ;
-	for (auto i = 0 ; i < (data.size()/196); ++i){
-		auto block = i + startblock ;
-		if (block< terraindata.size()) {
-			std::copy( data.data() + (i*196) , data.data() + (i*196) + 196, terraindata[block].raw().data()) ;
-		}
-		else {
-			break;
+	auto blocks = static_cast<std::size_t>(blockCount()) ;
+	if (startblock < blocks){
+		auto count = std::min(size/terrainblock_t::blocksize, blocks - startblock) ;
+		std::copy(data, data + count*terrainblock_t::blocksize, terrainstore.data() + startblock*terrainblock_t::blocksize);
+		if (stats() != nullptr){
+			stats()->counters().blocks += count ;
 		}
 	}
 	return true ;
@@ -51,20 +75,32 @@ auto uomap_t::processEntry(std::size_t entry, std::size_t index, std::vector<std
 
 //=================================================================================
 auto uomap_t::entriesToWrite()const ->int {
-	return (static_cast<int>(terraindata.size()) /uopblocksize) + ( (terraindata.size()%uopblocksize)!=0?1:0) ;
+	return (blockCount() /uopblocksize) + ( (blockCount()%uopblocksize)!=0?1:0) ;
 }
 //=================================================================================
 auto uomap_t::entryForWrite(int entry)->std::vector<unsigned char>  {
+	auto entrydata = std::vector<std::uint8_t>() ;
+	entrySpan(entry, entrydata);
+	return entrydata ;
+}
+//=================================================================================
+auto uomap_t::entrySpan(int entry, std::vector<std::uint8_t> &scratch) ->std::pair<const std::uint8_t*,std::size_t> {
+	// Every entry is a full section, the last one is padded with 0
+	constexpr auto entrysize = static_cast<std::size_t>(uopblocksize) * terrainblock_t::blocksize ;
 	auto startblock = entry * uopblocksize ;
-	std::fill(entrydata.data(),entrydata.data()+entrydata.size(),0) ;
-	
-	for (auto block = 0  ; block < uopblocksize ; ++block){
-		if ((startblock + block) >= terraindata.size() ){
-			break;
-		}
-		std::copy(terraindata[startblock+block].raw().data(),terraindata[startblock+block].raw().data()+196, entrydata.data()+(block*196));
+	auto count = std::min(uopblocksize, blockCount() - startblock) ;
+	if (!lazymode && (count == uopblocksize)){
+		// Straight from the store.  A lazy section could be dropped before the
+		// write is done, so those are copied.
+		return std::make_pair(terrainstore.data() + static_cast<std::size_t>(startblock)*terrainblock_t::blocksize, entrysize);
 	}
-	return entrydata ;
+	scratch.assign(entrysize,0);
+	if (count > 0){
+		// Read only, so a lazy section isn't pinned
+		const auto block = std::as_const(*this).terrainblock(startblock) ;
+		std::copy(block.data(), block.data() + count*terrainblock_t::blocksize, scratch.data());
+	}
+	return std::make_pair(scratch.data(), scratch.size());
 }
 //=================================================================================
 auto uomap_t::writeHash(int entry)->std::string {
@@ -72,10 +108,74 @@ auto uomap_t::writeHash(int entry)->std::string {
 	return this->format(hash,entry) ;
 }
 
+//=================================================================================
+auto uomap_t::faultTerrain(std::size_t section) const ->void {
+	auto startblock = section * uopblocksize ;
+	auto count = std::min<std::size_t>(uopblocksize, static_cast<std::size_t>(blockCount()) - startblock) ;
+	// The extents were checked against the source when it was loaded
+	const std::uint8_t *source = nullptr ;
+	auto amount = std::size_t(0) ;
+	auto inflated = std::vector<std::uint8_t>() ;
+	if (section < terrainextents.size()){
+		const auto &extent = terrainextents[section] ;
+		source = terrainsource.data() + extent.offset ;
+		amount = extent.length ;
+		// Inflated before it is admitted, so a failure leaves nothing behind
+		if (extent.inflated != 0){
+			if (!zdecompress(source, extent.length, extent.inflated, inflated)){
+				throw std::runtime_error(strutil::format("Unable to decompress terrain section %zu",section));
+			}
+			source = inflated.data() ;
+			amount = inflated.size() ;
+		}
+	}
+	auto &storage = terrainsections[section] ;
+	cache.admit(section, static_cast<std::uint32_t>(count*terrainblock_t::blocksize), [this](std::size_t unit){evict(unit);});
+	storage.assign(count*terrainblock_t::blocksize,0);
+	amount = std::min(amount, storage.size()) ;
+	if (amount > 0){
+		std::copy(source, source + amount, storage.data());
+	}
+}
+//=================================================================================
+auto uomap_t::faultArt(int block) const ->void {
+	auto &artblock = artdata[block] ;
+	auto length = std::uint32_t(0) ;
+	if (static_cast<std::size_t>(block) < artextents.size()){
+		length = artextents[block].length ;
+	}
+	cache.admit(artunit(block), length, [this](std::size_t unit){evict(unit);});
+	if (length > 0){
+		artblock.view(artsource.data() + artextents[block].offset, length);
+	}
+	if (artindexed && !artblock.indexed()){
+		artblock.buildIndex();
+	}
+}
+//=================================================================================
+auto uomap_t::evict(std::size_t unit) const ->void {
+	if (unit < terrainsections.size()){
+		std::vector<std::uint8_t>().swap(terrainsections[unit]);
+	}
+	else {
+		auto &artblock = artdata[unit - terrainsections.size()] ;
+		artblock.clear();
+		artblock.dropIndex();
+	}
+}
+//=================================================================================
+auto uomap_t::claimArt(int block) ->void {
+	auto unit = artunit(block) ;
+	if (!cache.resident(unit)){
+		cache.admit(unit, static_cast<std::uint32_t>(artdata[block].size()), [this](std::size_t unit){evict(unit);});
+	}
+	cache.pin(unit);
+}
+
 // public
 
 //=================================================================================
-uomap_t::uomap_t(int mapnum, int width, int height){
+uomap_t::uomap_t(int mapnum, int width, int height):artindexed(false),lazymode(false){
 	if (mapnum >= mapsizes.size()) {
 		throw std::out_of_range(strutil::format("%i exceeds maximum map size of %i",mapnum, mapsizes.size()-1));
 	}
@@ -92,8 +192,33 @@ auto uomap_t::setSize(int width, int height) ->void {
 		this->width = twidth;
 		this->height = theight;
 	}
-	terraindata.resize((this->width/8) * (this->height/8));
-	artdata.resize(terraindata.size()) ;
+	auto blocks = static_cast<std::size_t>(this->width/8) * static_cast<std::size_t>(this->height/8) ;
+	auto sections = (blocks + uopblocksize - 1) / uopblocksize ;
+	if (lazymode){
+		std::vector<std::uint8_t>().swap(terrainstore);
+		terrainsections.clear();
+		terrainsections.resize(sections);
+		cache.reset(sections + blocks);
+	}
+	else {
+		terrainstore.assign(blocks*terrainblock_t::blocksize,0);
+		std::vector<std::vector<std::uint8_t>>().swap(terrainsections);
+		cache.reset(0);
+	}
+	terrainextents.clear();
+	artextents.clear();
+	artdata.resize(blocks) ;
+	summaries.assign(blocks, blocksummary_t());
+}
+
+//=================================================================================
+auto uomap_t::lazy(bool state) ->void {
+	lazymode = state ;
+	terrainsource.close();
+	artsource.close();
+	std::vector<std::uint8_t>().swap(artstore);
+	artdata.clear();
+	setSize(width,height);
 }
 
 
@@ -103,25 +228,35 @@ auto uomap_t::setSize(int width, int height) ->void {
 
 //=================================================================================
 auto uomap_t::loadTerrainMul(const std::filesystem::path &path) ->bool {
+	staleSummaries(true, false);
+	if (lazymode){
+		// Each section is just its place in the file
+		if (!terrainsource.open(path.string(),mappedfile_t::access_t::random)){
+			return false ;
+		}
+		auto filesize = terrainsource.size() ;
+		terrainextents.assign(terrainsections.size(),extent_t{0,0,0,0});
+		for (std::size_t section = 0 ; section < terrainsections.size() ; ++section){
+			auto offset = static_cast<std::uint64_t>(section) * uopblocksize * terrainblock_t::blocksize ;
+			if (offset < filesize){
+				terrainextents[section] = extent_t{offset,static_cast<std::uint32_t>(std::min<std::uint64_t>(filesize - offset, static_cast<std::uint64_t>(uopblocksize) * terrainblock_t::blocksize)),0,0};
+			}
+			std::vector<std::uint8_t>().swap(terrainsections[section]);
+		}
+		cache.release(0, terrainsections.size());
+		return ((filesize % terrainblock_t::blocksize) == 0) && (filesize <= static_cast<std::size_t>(blockCount()) * terrainblock_t::blocksize) ;
+	}
+	// The file is our storage layout, so read it in one go.  It is good if it
+	// is whole blocks, and no more than the map holds.
 	auto input = std::ifstream(path.string(),std::ios::binary) ;
 	auto rvalue = false ;
-	auto block = 0 ;
 	if (input .is_open()){
-		rvalue = true ;
-		while (!input.eof() && input.good()) {
-			if (block < terraindata.size()) {
-				input.read(reinterpret_cast<char*>(terraindata[block].raw().data()),196) ;
-				if (input.gcount()!= 196){
-					rvalue = false ;
-					break;
-				}
-				++block ;
-			}
-			else {
-				rvalue = false ;
-				break;
-			}
-		}
+		input.seekg(0,std::ios::end);
+		auto filesize = static_cast<std::size_t>(input.tellg()) ;
+		input.seekg(0,std::ios::beg);
+		auto amount = std::min(filesize,terrainstore.size()) ;
+		input.read(reinterpret_cast<char*>(terrainstore.data()),static_cast<std::streamsize>(amount)) ;
+		rvalue = (static_cast<std::size_t>(input.gcount()) == amount) && ((filesize % terrainblock_t::blocksize) == 0) && (filesize <= terrainstore.size()) ;
 	}
 	return rvalue ;
 }
@@ -129,33 +264,95 @@ auto uomap_t::loadTerrainMul(const std::filesystem::path &path) ->bool {
 //=================================================================================
 auto uomap_t::loadTerrainUOP(const std::filesystem::path &path) ->bool {
 	auto hash = this->format("build/map%ilegacymul/%s", mapnumber,"%.8u.dat");
-	return loadUOP(path.string(), 0x300, hash);
-	
+	staleSummaries(true, false);
+	if (!lazymode){
+		return loadUOP(path.string(), 0x300, hash);
+	}
+	// Only the entry table is read, the entries are copied out as they are used
+	auto phase = phasestats_t::scope_t(stats(), "loadUOPDirectory") ;
+	if (!terrainsource.open(path.string(),mappedfile_t::access_t::random)){
+		return false ;
+	}
+	auto directory = std::vector<uopentry_t>() ;
+	if (!loadUOPDirectory(terrainsource, 0x300, hash, "", directory)){
+		return false ;
+	}
+	phase.counters().entries += directory.size() ;
+	terrainextents.assign(terrainsections.size(),extent_t{0,0,0,0});
+	for (auto &storage : terrainsections){
+		std::vector<std::uint8_t>().swap(storage);
+	}
+	cache.release(0, terrainsections.size());
+	for (const auto &entry : directory){
+		if (entry.index == std::numeric_limits<std::size_t>::max()){
+			if (!nonIndexHash(entry.hash, entry.entry, terrainsource.data() + entry.offset, entry.length)){
+				return false ;
+			}
+			continue ;
+		}
+		// A compressed section is inflated when it is read in.  Its stored
+		// hash is of the compressed data, so it is left to terrainHash to work
+		// out from the inflated one.
+		auto extent = extent_t{entry.offset,entry.length,entry.data_block_hash,0} ;
+		if (entry.compression == 1){
+			if (!zlibAvailable()){
+				std::cerr << "Terrain entry "s << entry.entry << " is compressed, and this was built without zlib (UOP_ZLIB)" << std::endl;
+				return false ;
+			}
+			extent = extent_t{entry.offset,entry.length,0,entry.decompressed_length} ;
+		}
+		else if (entry.compression != 0){
+			std::cerr << "Terrain entry "s << entry.entry << " has an unknown compression ("s << entry.compression << ")" << std::endl;
+			return false ;
+		}
+		if (entry.index < terrainextents.size()){
+			terrainextents[entry.index] = extent ;
+		}
+	}
+	return true ;
 }
 
 //=================================================================================
 auto uomap_t::applyTerrainDiff(const std::string &difflpath,const std::string &diffpath) ->bool {
-	auto rvalue = false ;
-	auto diffl = std::ifstream(difflpath,std::ios::binary) ;
-	auto diff = std::ifstream(diffpath,std::ios::binary);
-	if (diffl.is_open() && diff.is_open()){
-		rvalue = true ;
-		auto block = std::uint32_t(0) ;
-		while (!diffl.eof() && diffl.good()){
-			diffl.read(reinterpret_cast<char*>(&block),4);
-			if (diffl.gcount()==4) {
-				if (block >= terraindata.size()){
-					rvalue = false ;
-					break;
-				}
-				diff.read(reinterpret_cast<char*>(terraindata[block].raw().data()),196);
-				if (diff.gcount()!= 196){
-					rvalue = false ;
-					break;
-				}
-			}
+	struct patch_t {
+		std::uint32_t block ;
+		std::uint64_t offset ;
+		std::uint8_t *destination ;
+	};
+	// Both are mapped, the nth block in the list is the nth in the data
+	auto phase = phasestats_t::scope_t(stats(), "applyTerrainDiff") ;
+	auto diffl = mappedfile_t(difflpath) ;
+	auto diff = mappedfile_t(diffpath) ;
+	if (!diffl.is_open() || !diff.is_open()){
+		return false ;
+	}
+	auto rvalue = true ;
+	auto count = diffl.size() / 4 ;
+	auto patches = std::vector<patch_t>() ;
+	patches.reserve(count);
+	for (std::size_t entry = 0 ; entry < count ; ++entry){
+		auto patch = patch_t{0, static_cast<std::uint64_t>(entry) * terrainblock_t::blocksize, nullptr} ;
+		std::memcpy(&patch.block,diffl.data() + entry*4,4);
+		if ((patch.block >= static_cast<std::uint32_t>(blockCount())) || (patch.offset + terrainblock_t::blocksize > diff.size())){
+			rvalue = false ;
+			break;
 		}
+		patches.push_back(patch);
 	}
+	lastPerBlock(patches);
+	phase.counters().entries += count ;
+	phase.counters().blocks += patches.size() ;
+	phase.counters().bytesread += diffl.size() + patches.size()*terrainblock_t::blocksize ;
+	// Where each goes is found first, as a lazy map reads in (and pins) the
+	// sections as it goes
+	for (auto &patch : patches){
+		patch.destination = terrainblock(static_cast<int>(patch.block)).data() ;
+		summaries[patch.block].terraincurrent = false ;
+	}
+	parallel::forEach(patches.size(), (patches.size() < parallelpatches) ? 1 : jobs(), [&patches, &diff](std::size_t index){
+		const auto &patch = patches[index] ;
+		std::memcpy(patch.destination, diff.data() + patch.offset, terrainblock_t::blocksize);
+	});
 	return rvalue ;
 }
 
@@ -165,9 +362,12 @@ auto uomap_t::writeTerrainMul(const std::string &path) const ->bool {
 	auto output = std::ofstream(path,std::ios::binary) ;
 	if (output.is_open()){
 		rvalue = true ;
-		for (const auto &block : terraindata){
-			output.write(reinterpret_cast<const char*>(block.raw().data()),block.raw().size());
+		// A section at a time, as that is what is contiguous in lazy mode
+		for (auto startblock = 0 ; startblock < blockCount() ; startblock += uopblocksize){
+			auto count = std::min(uopblocksize, blockCount() - startblock) ;
+			output.write(reinterpret_cast<const char*>(terrainblock(startblock).data()),static_cast<std::streamsize>(count)*terrainblock_t::blocksize);
 		}
+		rvalue = output.good() ;
 	}
 	return rvalue ;
 }
@@ -179,85 +379,170 @@ auto uomap_t::writeTerrainUOP(const std::string &path)  ->bool {
 
 //=================================================================================
 auto uomap_t::loadArt(const std::string &idxpath, const std::string &mulpath) ->bool {
-	auto idx = std::ifstream(idxpath,std::ios::binary) ;
+	auto phase = phasestats_t::scope_t(stats(), "loadArt") ;
+	staleSummaries(false, true);
+	if (lazymode){
+		return loadArtDirectory(idxpath, mulpath);
+	}
 	auto mul = std::ifstream(mulpath,std::ios::binary) ;
-	auto rvalue = false ;
-	if (idx.is_open() && mul.is_open()){
-		rvalue = true ;
+	if (!mul.is_open()){
+		return false ;
+	}
+	// clear all the statics
+	for (auto &artblock:artdata){
+		artblock.clear();
+	}
+	// The records are read in one go, and the blocks just share their
+	// part of it
+	mul.seekg(0,std::ios::end);
+	auto mulsize = static_cast<std::size_t>(mul.tellg()) ;
+	mul.seekg(0,std::ios::beg);
+	artstore.resize(mulsize);
+	mul.read(reinterpret_cast<char*>(artstore.data()),static_cast<std::streamsize>(mulsize));
+	if (static_cast<std::size_t>(mul.gcount()) != mulsize){
+		artstore.clear();
+		return false ;
+	}
+	phase.counters().bytesread += mulsize ;
+	auto extents = std::vector<extent_t>() ;
+	if (!readArtIndex(idxpath, mulsize, extents)){
+		return false ;
+	}
+	for (std::size_t block = 0 ; block < extents.size() ; ++block){
+		if (extents[block].length > 0){
+			artdata[block].view(artstore.data() + extents[block].offset, extents[block].length) ;
+		}
+	}
+	if (artindexed){
+		for (auto &artblock : artdata){
+			artblock.buildIndex();
+		}
+	}
+	return true ;
+}
+//=================================================================================
+auto uomap_t::loadArtDirectory(const std::string &idxpath, const std::string &mulpath) ->bool {
+	if (!artsource.open(mulpath,mappedfile_t::access_t::random)){
+		return false ;
+	}
+	for (auto &artblock:artdata){
+		artblock.clear();
+	}
+	cache.release(artunit(0), artunit(blockCount()));
+	return readArtIndex(idxpath, artsource.size(), artextents) ;
+}
+
+//=================================================================================
+auto uomap_t::readArtIndex(const std::string &idxpath, std::size_t mulsize, std::vector<extent_t> &extents) const ->bool {
+	extents.assign(artdata.size(),extent_t{0,0,0,0});
+	auto idx = mappedfile_t(idxpath) ;
+	if (!idx.is_open()){
+		return false ;
+	}
+	auto count = idx.size() / 12 ;
+	if (count > artdata.size()){
+		return false ;
+	}
+	auto *counters = (stats() != nullptr) ? &stats()->counters() : nullptr ;
+	if (counters != nullptr){
+		counters->bytesread += idx.size() ;
+	}
+	const auto *entry = idx.data() ;
+	for (std::size_t block = 0 ; block < count ; ++block, entry += 12){
 		auto index = std::uint32_t(0) ;
 		auto length = std::uint32_t(0) ;
-		auto extra = std::uint32_t(0) ;
-		// clear all the statics
-		for (auto &artblock:artdata){
-			artblock.clear();
-		}
-		auto block = 0 ;
-		while (!idx.eof() && idx.good()){
-			idx.read(reinterpret_cast<char*>(&index),4);
-			idx.read(reinterpret_cast<char*>(&length),4);
-			idx.read(reinterpret_cast<char*>(&extra),4);
-			if (idx.gcount()==4){
-				if (block >= artdata.size()){
-					rvalue = false ;
-					break;
-				}
-				if ((index < 0xFFFFFFFE) && (length >0) && (length < 0xFFFFFFFF)) {
-					mul.seekg(index,std::ios::beg) ;
-					artdata[block].raw().resize(length,0) ;
-					mul.read(reinterpret_cast<char*>(artdata[block].raw().data()),length) ;
-					if (mul.gcount()!= length){
-						rvalue = false ;
-						break;
-					}
-				}
+		std::memcpy(&index,entry,4);
+		std::memcpy(&length,entry + 4,4);
+		if ((index < 0xFFFFFFFE) && (length >0) && (length < 0xFFFFFFFF)) {
+			if (static_cast<std::size_t>(index) + length > mulsize){
+				return false ;
+			}
+			extents[block] = extent_t{index,length,0,0};
+			if (counters != nullptr){
+				++counters->blocks ;
+				counters->records += length / 7 ;
 			}
-			block++ ;
 		}
 	}
-	return rvalue ;
+	return true ;
 }
 //=================================================================================
 auto uomap_t::applyArtDiff(const std::string &difflpath, const std::string &diffipath, const std::string &diffpath) ->bool {
-	auto rvalue = false ;
-	auto diffl = std::ifstream(difflpath, std::ios::binary) ;
-	auto diffi = std::ifstream(diffipath, std::ios::binary) ;
-	auto diff = std::ifstream(diffpath, std::ios::binary) ;
-	if (diffl.is_open() && diffi.is_open() && diff.is_open()){
-		rvalue = true ;
-		auto block = std::uint32_t(0) ;
-		auto index = std::uint32_t(0) ;
-		auto length = std::uint32_t(0) ;
-		auto extra = std::uint32_t(0) ;
-		
-		while (diffl.good() && !diffl.eof()){
-			diffl.read(reinterpret_cast<char*>(&block),4);
-			if (diffl.gcount()==4){
-				if (block >= artdata.size()) {
-					rvalue = false ;
-					break;
-				}
-				diffi.read(reinterpret_cast<char*>(&index),4);
-				diffi.read(reinterpret_cast<char*>(&length),4);
-				diffi.read(reinterpret_cast<char*>(&extra),4);
-				if (diffi.gcount() != 4){
-					rvalue = false ;
-					break;
-				}
-				if ((index >= 0xFFFFFFFE ) || (length == 0) || (length >= 0xFFFFFFFF)) {
-					artdata[block].clear() ;
-				}
-				else {
-					artdata[block].raw().resize(length,0);
-					diff.seekg(index,std::ios::beg);
-					diff.read(reinterpret_cast<char*>(artdata[block].raw().data()),length);
-					if (diff.gcount()!= length){
-						rvalue = false ;
-						break;
-					}
-				}
+	struct patch_t {
+		std::uint32_t block ;
+		std::uint32_t offset ;
+		std::uint32_t length ;
+	};
+	auto phase = phasestats_t::scope_t(stats(), "applyArtDiff") ;
+	auto diffl = mappedfile_t(difflpath) ;
+	auto diffi = mappedfile_t(diffipath) ;
+	auto diff = mappedfile_t(diffpath) ;
+	if (!diffl.is_open() || !diffi.is_open() || !diff.is_open()){
+		return false ;
+	}
+	// The list and index are resolved up front, and then the blocks are
+	// replaced in parallel
+	auto count = diffl.size() / 4 ;
+	auto rvalue = (count * 12 <= diffi.size()) ;
+	if (!rvalue){
+		count = diffi.size() / 12 ;
+	}
+	auto patches = std::vector<patch_t>() ;
+	patches.reserve(count);
+	for (std::size_t entry = 0 ; entry < count ; ++entry){
+		auto patch = patch_t{0,0,0} ;
+		std::memcpy(&patch.block,diffl.data() + entry*4,4);
+		std::memcpy(&patch.offset,diffi.data() + entry*12,4);
+		std::memcpy(&patch.length,diffi.data() + entry*12 + 4,4);
+		if (patch.block >= artdata.size()){
+			rvalue = false ;
+			break;
+		}
+		if ((patch.offset >= 0xFFFFFFFE ) || (patch.length == 0) || (patch.length >= 0xFFFFFFFF)) {
+			patch.length = 0 ;
+		}
+		else if (static_cast<std::size_t>(patch.offset) + patch.length > diff.size()){
+			rvalue = false ;
+			break;
+		}
+		patches.push_back(patch);
+	}
+	lastPerBlock(patches);
+	phase.counters().entries += count ;
+	phase.counters().blocks += patches.size() ;
+	phase.counters().bytesread += diffl.size() + diffi.size() ;
+	for (const auto &patch : patches){
+		summaries[patch.block].artcurrent = false ;
+		phase.counters().bytesread += patch.length ;
+		phase.counters().records += patch.length / 7 ;
+	}
+	if (lazymode){
+		// A block already read in is kept until it is claimed below
+		for (const auto &patch : patches){
+			if (cache.resident(artunit(static_cast<int>(patch.block)))){
+				cache.pin(artunit(static_cast<int>(patch.block)));
 			}
 		}
 	}
+	parallel::forEach(patches.size(), (patches.size() < parallelpatches) ? 1 : jobs(), [this, &patches, &diff](std::size_t index){
+		const auto &patch = patches[index] ;
+		auto &artblock = artdata[patch.block] ;
+		if (patch.length == 0){
+			artblock.clear() ;
+		}
+		else {
+			artblock.raw().assign(diff.data() + patch.offset, diff.data() + patch.offset + patch.length);
+			if (artindexed){
+				artblock.buildIndex();
+			}
+		}
+	});
+	if (lazymode){
+		// The diff replaces the block, so there is nothing to fault in
+		for (const auto &patch : patches){
+			claimArt(static_cast<int>(patch.block));
+		}
+	}
 	return rvalue ;
 }
 
@@ -271,7 +556,8 @@ auto uomap_t::writeArt(const std::string &idxpath, const std::string &mulpath)co
 		auto index = std::uint32_t(0) ;
 		auto length = std::uint32_t(0) ;
 		auto extra = std::uint32_t(0) ;
-		for (const auto &block : artdata){
+		for (auto entry = 0 ; entry < blockCount() ; ++entry){
+			const auto &block = artblock(entry) ;
 			if (block.size()== 0){
 				index = 0xFFFFFFFF;
 				length = 0 ;
@@ -284,7 +570,7 @@ auto uomap_t::writeArt(const std::string &idxpath, const std::string &mulpath)co
 			idx.write(reinterpret_cast<char*>(&length),4);
 			idx.write(reinterpret_cast<char*>(&extra),4);
 			if (length > 0){
-				mul.write(reinterpret_cast<const char*>(block.raw().data()),length);
+				mul.write(reinterpret_cast<const char*>(block.data()),length);
 			}
 		}
 	}
@@ -293,19 +579,105 @@ auto uomap_t::writeArt(const std::string &idxpath, const std::string &mulpath)co
 }
 
 
+//=================================================================================
+auto uomap_t::indexArt(bool state) ->void {
+	artindexed = state ;
+	for (auto block = 0 ; block < blockCount() ; ++block){
+		if (lazymode && !cache.resident(artunit(block))){
+			// Indexed (or not) when it is faulted in
+			continue ;
+		}
+		auto &artblock = artdata[block] ;
+		if (state){
+			artblock.buildIndex();
+		}
+		else {
+			artblock.dropIndex();
+		}
+	}
+}
+
+//=================================================================================
+auto uomap_t::staleSummaries(bool terrain, bool art) ->void {
+	for (auto &summary : summaries){
+		summary.terraincurrent = summary.terraincurrent && !terrain ;
+		summary.artcurrent = summary.artcurrent && !art ;
+	}
+}
+//=================================================================================
+auto uomap_t::summary(int block) const ->blocksummary_t {
+	// Worked out here if need be, not kept, so a const map is never written
+	auto rvalue = summaries[block] ;
+	if (!rvalue.terraincurrent){
+		rvalue.summarise(terrainblock(block));
+	}
+	if (!rvalue.artcurrent){
+		rvalue.summarise(artblock(block));
+	}
+	return rvalue ;
+}
+//=================================================================================
+auto uomap_t::summarise() ->void {
+	// A lazy map reads blocks in through the cache, which is one thread only.
+	// The blocks are only read, so they aren't pinned as they would be for a
+	// change.
+	const auto &map = *this ;
+	parallel::forEach(summaries.size(), lazymode ? 1 : jobs(), [this, &map](std::size_t index){
+		auto block = static_cast<int>(index) ;
+		auto &summary = summaries[index] ;
+		if (!summary.terraincurrent){
+			summary.summarise(map.terrainblock(block));
+		}
+		if (!summary.artcurrent){
+			summary.summarise(map.artblock(block));
+		}
+	});
+}
+
+//=================================================================================
+auto uomap_t::terrainHash(std::size_t section) const ->std::uint32_t {
+	if (lazymode && (section < terrainextents.size()) && (terrainextents[section].hash != 0) && !cache.pinned(section)){
+		return terrainextents[section].hash ;
+	}
+	auto startblock = static_cast<int>(section) * uopblocksize ;
+	auto count = std::min(uopblocksize, blockCount() - startblock) ;
+	if (count <= 0){
+		return 1 ;
+	}
+	return uopindex_t::hashAdler32(terrainblock(startblock).data(), static_cast<std::size_t>(count)*terrainblock_t::blocksize) ;
+}
+//=================================================================================
+auto uomap_t::artHash(std::size_t section) const ->std::uint32_t {
+	// The length of each block goes in as well, so records can't move between
+	// blocks unnoticed
+	auto adler = std::uint32_t(1) ;
+	auto startblock = static_cast<int>(section) * uopblocksize ;
+	auto lastblock = std::min(startblock + uopblocksize, blockCount()) ;
+	for (auto block = startblock ; block < lastblock ; ++block){
+		const auto &art = artblock(block) ;
+		auto length = static_cast<std::uint32_t>(art.size()) ;
+		adler = uopindex_t::hashAdler32(reinterpret_cast<const std::uint8_t*>(&length), 4, adler);
+		adler = uopindex_t::hashAdler32(art.data(), art.size(), adler);
+	}
+	return adler ;
+}
+
 //=================================================================================
 auto uomap_t::terrain(int x, int y) const ->std::pair<std::uint16_t,std::int8_t> {
 	auto [block,xoff,yoff] = calcBlockOffset(x, y) ;
-	if (block < terraindata.size()) {
-		return terraindata[block].terrain(xoff, yoff);
+	if (block < blockCount()) {
+		return terrainblock(block).terrain(xoff, yoff);
 	}
 	throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
 }
 //=================================================================================
 auto uomap_t::terrain(int x, int y, std::uint16_t tileid, std::int8_t altitude) ->void {
 	auto [block,xoff,yoff] = calcBlockOffset(x, y) ;
-	if (block < terraindata.size()) {
-		terraindata[block].terrain(xoff, yoff,tileid,altitude);
+	if (block < blockCount()) {
+		auto terrain = terrainblock(block) ;
+		terrain.terrain(xoff, yoff,tileid,altitude);
+		summaries[block].summarise(terrain);
+		return ;
 	}
 	throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
 	
@@ -315,7 +687,7 @@ auto uomap_t::terrain(int x, int y, std::uint16_t tileid, std::int8_t altitude)
 auto uomap_t::art(int x, int y) const ->std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>> {
 	auto [block,xoff,yoff] = calcBlockOffset(x, y);
 	if (block < artdata.size()){
-		return artdata[block].art(xoff,yoff) ;
+		return artblock(block).art(xoff,yoff) ;
 	}
 	throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
 	
@@ -324,7 +696,10 @@ auto uomap_t::art(int x, int y) const ->std::vector<std::tuple<std::uint16_t,std
 auto uomap_t::art(int x, int y, std::uint16_t tileid, std::int8_t altitude, std::uint16_t hue)  ->void {
 	auto [block,xoff,yoff] = calcBlockOffset(x, y);
 	if (block < artdata.size()){
-		artdata[block].art(xoff,yoff,tileid,altitude,hue) ;
+		auto &art = artblock(block) ;
+		art.art(xoff,yoff,tileid,altitude,hue) ;
+		summaries[block].summarise(art);
+		return ;
 	}
 	throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
 	
@@ -333,17 +708,37 @@ auto uomap_t::art(int x, int y, std::uint16_t tileid, std::int8_t altitude, std:
 auto uomap_t::art(int x, int y,int z) const ->std::vector<std::tuple<std::uint16_t,std::int8_t,std::uint16_t>> {
 	auto [block,xoff,yoff] = calcBlockOffset(x, y);
 	if (block < artdata.size()){
-		return artdata[block].art(xoff,yoff,z) ;
+		return artblock(block).art(xoff,yoff,z) ;
 	}
 	throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
 	
 }
+//=================================================================================
+auto uomap_t::terrainIn(int x0, int y0, int x1, int y1, std::vector<regiontile_t> &tiles, int low, int high) const ->std::size_t {
+	tiles.clear();
+	forEachTerrainIn(x0, y0, x1, y1, [&tiles](int x, int y, std::uint16_t tileid, std::int8_t altitude){
+		tiles.push_back(regiontile_t{x,y,artrecord_t{tileid,altitude,0}});
+	}, low, high);
+	return tiles.size() ;
+}
+//=================================================================================
+auto uomap_t::artIn(int x0, int y0, int x1, int y1, std::vector<regiontile_t> &tiles, int low, int high) const ->std::size_t {
+	tiles.clear();
+	forEachArtIn(x0, y0, x1, y1, [&tiles](int x, int y, const artrecord_t &record){
+		tiles.push_back(regiontile_t{x,y,record});
+	}, low, high);
+	return tiles.size() ;
+}
+
 //=================================================================================
 auto uomap_t::remove(int x, int y) ->void {
 	
 	auto [block,xoff,yoff] = calcBlockOffset(x, y);
 	if (block < artdata.size()){
-		artdata[block].remove(xoff,yoff) ;
+		auto &art = artblock(block) ;
+		art.remove(xoff,yoff) ;
+		summaries[block].summarise(art);
+		return ;
 	}
 	throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
 	
@@ -352,7 +747,10 @@ auto uomap_t::remove(int x, int y) ->void {
 auto uomap_t::remove(int x, int y, int z) ->void {
 	auto [block,xoff,yoff] = calcBlockOffset(x, y);
 	if (block < artdata.size()){
-		artdata[block].remove(xoff,yoff,z) ;
+		auto &art = artblock(block) ;
+		art.remove(xoff,yoff,z) ;
+		summaries[block].summarise(art);
+		return ;
 	}
 	throw std::out_of_range(strutil::format("Invalid loc(%i,%i), map size %i,%i",x,y,width,height));
 }
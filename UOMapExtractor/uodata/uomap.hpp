@@ -10,9 +10,13 @@
 #include <utility>
 #include <tuple>
 #include <filesystem>
+#include <algorithm>
+#include <cstring>
 
 #include "mapblock.hpp"
 #include "uopfile.hpp"
+#include "mappedfile.hpp"
+#include "blockcache.hpp"
 
 /*
  Supports manipulation of a UO map.
@@ -41,31 +45,204 @@ class uomap_t : public uopfile {
 		{2560,2048},{1448,1448},{1280,4096}
 	}};
 
-	std::vector<terrainblock_t> terraindata ;
-	std::vector<artblock_t> artdata ;
+	// All the terrain blocks, back to back in the mul (and uop entry) layout
+	std::vector<std::uint8_t> terrainstore ;
+	// The statics records as read from statics%i.mul.  Blocks share their
+	// records from here (the view in each artblock_t is the offset/length from
+	// staidx%i.mul), until they are edited and get their own copy.
+	std::vector<std::uint8_t> artstore ;
+	// Mutable, as a lazy map fills them in on first use
+	mutable std::vector<artblock_t> artdata ;
 	
 	int mapnumber ;
 	int width ;
 	int height ;
+	bool artindexed ;
+
+	//=========================================================================
+	// Lazy mode.  The sources stay mapped, and extents says where each terrain
+	// section (uop entry) or statics block is in them.  A terrain section is
+	// copied out when first used (it is empty until then), a statics block
+	// becomes a view into the mapped statics%i.mul.  The cache keeps track of
+	// what is resident (units are the terrain sections, then the statics
+	// blocks), and drops what has not been used lately when over budget.
+	// Edited units are pinned, as they can't be read in again.
+	struct extent_t {
+		std::uint64_t offset ;
+		std::uint32_t length ;
+		std::uint32_t hash ;	// The uop data hash (Adler32), 0 if none
+		std::uint32_t inflated ;	// For a compressed terrain section, its length inflated (0 if stored as is)
+	};
+	bool lazymode ;
+	mappedfile_t terrainsource ;
+	std::vector<extent_t> terrainextents ;
+	mutable std::vector<std::vector<std::uint8_t>> terrainsections ;
+	mappedfile_t artsource ;
+	std::vector<extent_t> artextents ;
+	mutable blockcache_t cache ;
+
+	// A summary of each block (see blocksummary_t).  A load leaves them to be
+	// worked out by summarise(), an edit works its block's out again.  A lazy
+	// map is one thread only, so a search works one out when it first asks.
+	// An eager map may be searched from many threads at once, so a search
+	// never writes one, it just passes over nothing until they are current.
+	mutable std::vector<blocksummary_t> summaries ;
+	auto staleSummaries(bool terrain, bool art) ->void ;
+	// The summary to pass a block over on, null if there is none to go by
+	auto terrainSummary(int block) const ->const blocksummary_t* {
+		auto &summary = summaries[block] ;
+		if (!summary.terraincurrent){
+			if (!lazymode){
+				return nullptr ;
+			}
+			summary.summarise(terrainblock(block));
+		}
+		return &summary ;
+	}
+	auto artSummary(int block) const ->const blocksummary_t* {
+		auto &summary = summaries[block] ;
+		if (!summary.artcurrent){
+			if (!lazymode){
+				return nullptr ;
+			}
+			summary.summarise(artblock(block));
+		}
+		return &summary ;
+	}
+	
+	auto loadArtDirectory(const std::string &idxpath, const std::string &mulpath) ->bool ;
+	// staidx%i.mul, mapped and resolved into an extent per block (length 0 if
+	// it has no statics).  False if it can't be read, or doesn't fit the map or
+	// a statics file of mulsize.
+	auto readArtIndex(const std::string &idxpath, std::size_t mulsize, std::vector<extent_t> &extents) const ->bool ;
+	auto faultTerrain(std::size_t section) const ->void ;
+	auto faultArt(int block) const ->void ;
+	auto evict(std::size_t unit) const ->void ;
+	auto artunit(int block) const ->std::size_t {return terrainsections.size() + static_cast<std::size_t>(block);}
+	// A lazy statics block that is replaced outright (not read in first)
+	auto claimArt(int block) ->void ;
+	// Where a block is (a lazy section is read in first).  Only a non const
+	// map hands out its storage to be changed.
+	auto terrainaddress(int block) const ->const std::uint8_t* {
+		if (lazymode){
+			auto section = static_cast<std::size_t>(block/sectionblocks) ;
+			if (!cache.resident(section)){
+				faultTerrain(section);
+			}
+			else {
+				cache.hit(section);
+			}
+			return terrainsections[section].data() + static_cast<std::size_t>(block%sectionblocks)*terrainblock_t::blocksize ;
+		}
+		return terrainstore.data() + static_cast<std::size_t>(block)*terrainblock_t::blocksize ;
+	}
+	auto terrainaddress(int block) ->std::uint8_t* {
+		if (lazymode){
+			std::as_const(*this).terrainaddress(block);
+			return terrainsections[static_cast<std::size_t>(block/sectionblocks)].data() + static_cast<std::size_t>(block%sectionblocks)*terrainblock_t::blocksize ;
+		}
+		return terrainstore.data() + static_cast<std::size_t>(block)*terrainblock_t::blocksize ;
+	}
+	auto artblock(int block) const ->artblock_t& {
+		if (lazymode){
+			if (!cache.resident(artunit(block))){
+				faultArt(block);
+			}
+			else {
+				cache.hit(artunit(block));
+			}
+		}
+		return artdata[block] ;
+	}
+	// For a change, so the block is pinned
+	auto artblock(int block) ->artblock_t& {
+		auto &rvalue = std::as_const(*this).artblock(block) ;
+		if (lazymode){
+			cache.pin(artunit(block));
+		}
+		return rvalue ;
+	}
 	
 	auto calcBlock(int x, int y) const -> int ;
 	auto calcXYForBlock(int block) const -> std::pair<int, int> ;
 	auto calcBlockOffset(int x, int y) const -> std::tuple<int, int,int> ;
+	auto blockCount() const ->int {return static_cast<int>(artdata.size());}
+	// For a change, so the section is pinned
+	auto terrainblock(int block) ->terrainblock_t {
+		auto rvalue = terrainblock_t(terrainaddress(block)) ;
+		if (lazymode){
+			cache.pin(static_cast<std::size_t>(block/sectionblocks));
+		}
+		return rvalue ;
+	}
+	// A read only view, so the storage can't be changed through a const uomap_t
+	auto terrainblock(int block) const ->terrainview_t {return terrainview_t(terrainaddress(block));}
+	//=========================================================================
+	// visit(block, xbase, ybase, xfirst, yfirst, xlast, ylast) for each block
+	// the rectangle x0,y0 to x1,y1 (inclusive) touches, clipped to the map, in
+	// block order.  first/last are the part of the block (0-7) in it.
+	template <typename Visitor>
+	auto forEachBlockIn(int x0, int y0, int x1, int y1, Visitor &&visit) const ->void {
+		x0 = std::max(x0, 0) ;
+		y0 = std::max(y0, 0) ;
+		x1 = std::min(x1, width - 1) ;
+		y1 = std::min(y1, height - 1) ;
+		auto blocksdown = height/8 ;
+		for (auto blockx = x0/8 ; blockx <= x1/8 && x0 <= x1 ; ++blockx){
+			auto xbase = blockx*8 ;
+			auto xfirst = std::max(x0 - xbase, 0) ;
+			auto xlast = std::min(x1 - xbase, 7) ;
+			for (auto blocky = y0/8 ; blocky <= y1/8 && y0 <= y1 ; ++blocky){
+				auto ybase = blocky*8 ;
+				visit(blockx*blocksdown + blocky, xbase, ybase, xfirst, std::max(y0 - ybase, 0), xlast, std::min(y1 - ybase, 7));
+			}
+		}
+	}
 	
 
 	//  UOP methods
-	auto processEntry(std::size_t entry, std::size_t index, std::vector<std::uint8_t> &data) ->bool final ;
+	auto processEntry(std::size_t entry, std::size_t index, const std::uint8_t *data, std::size_t size) ->bool final ;
 
 	auto entriesToWrite()const ->int final ;
 	auto entryForWrite(int entry)->std::vector<unsigned char> final ;
+	auto entrySpan(int entry, std::vector<std::uint8_t> &scratch) ->std::pair<const std::uint8_t*,std::size_t> final ;
 
 	auto writeHash(int entry)->std::string ;
 
 public:
+	// Blocks in a terrain uop entry
+	static constexpr auto sectionblocks = 4096 ;
 	static auto maxmap() ->size_t {return mapsizes.size();}
+	static auto defaultSize(int mapnum) ->std::pair<int,int> {return mapsizes.at(mapnum);}
 	uomap_t(int mapnum=0, int width=0, int height = 0);
+	// The statics blocks point into our own store, so no copies (moves are fine,
+	// the store's buffer moves with it)
+	uomap_t(const uomap_t&) = delete ;
+	auto operator=(const uomap_t&) ->uomap_t& = delete ;
+	uomap_t(uomap_t&&) = default ;
+	auto operator=(uomap_t&&) ->uomap_t& = default ;
 	auto setSize(int width, int height) ->void ;
 	auto size() const ->std::pair<int,int> {return std::make_pair(width,height);}
+	auto map() const ->int {return mapnumber;}
+	// Switching modes empties the map, so set it before loading
+	auto lazy(bool state) ->void ;
+	auto lazy() const ->bool {return lazymode;}
+	// The most a lazy map keeps read in (terrain sections and statics
+	// records), in bytes, 0 is no limit.  Edited blocks are always kept, so
+	// they count against it but are never dropped.  A lower budget takes
+	// effect on the next read.
+	auto budget(std::uint64_t bytes) ->void {cache.budget(bytes);}
+	auto budget() const ->std::uint64_t {return cache.budget();}
+	auto cacheStats() const ->const blockcache_t::stats_t& {return cache.stats();}
+
+	//=========================================================================
+	// Content hashes (Adler32) of a section (sectionblocks blocks, a terrain uop
+	// entry), to tell which parts of a map changed between runs.  Terrain uses
+	// the hash in the uop table when a lazy map has one for the section (and it
+	// is unchanged), otherwise the blocks are hashed.
+	auto sectionCount() const ->std::size_t {return (artdata.size() + sectionblocks - 1) / sectionblocks;}
+	auto terrainHash(std::size_t section) const ->std::uint32_t ;
+	auto artHash(std::size_t section) const ->std::uint32_t ;
 
 	auto loadTerrainMul(const std::filesystem::path &path) ->bool ;
 	auto loadTerrainUOP(const std::filesystem::path &path) ->bool ;
@@ -76,6 +253,17 @@ public:
 	auto loadArt(const std::string &idxpath, const std::string &mulpath) ->bool ;
 	auto applyArtDiff(const std::string &difflpath, const std::string &diffipath, const std::string &diffpath) ->bool ;
 	auto writeArt(const std::string &idxpath, const std::string &mulpath)const  ->bool ;
+	// Keep a per cell index on every statics block (see artblock_t), built as
+	// statics are loaded and kept current on edits.  Off by default.
+	auto indexArt(bool state) ->void ;
+	auto indexArt() const ->bool {return artindexed;}
+	// The summary of a block (numbered as for the visitors), for a search to
+	// pass over the blocks that can't have what it wants.  summarise() works
+	// out any that aren't current (in parallel unless lazy), and an eager map
+	// only passes blocks over once it has, so call it after a load.  As it
+	// changes the map, nothing else may use the map while it runs.
+	auto summary(int block) const ->blocksummary_t ;
+	auto summarise() ->void ;
 	
 	auto terrain(int x, int y) const ->std::pair<std::uint16_t,std::int8_t> ;
 	auto terrain(int x, int y, std::uint16_t tileid, std::int8_t altitude) ->void ;
@@ -85,6 +273,175 @@ public:
 	auto remove(int x, int y) ->void ;
 	auto remove(int x, int y, int z) ->void ;
 
+	//=========================================================================
+	// Region queries, for the rectangle x0,y0 to x1,y1 (inclusive, clipped to
+	// the map), and only what has an altitude from low to high (inclusive).
+	// The tiles are cleared and refilled, so a caller that keeps the vector
+	// between queries doesn't allocate once it is big enough.  Returns the
+	// number found.  See forEachTerrainIn/forEachArtIn for the order.
+	struct regiontile_t {
+		int x ;
+		int y ;
+		artrecord_t tile ;			// hue is 0 for terrain
+	};
+	auto terrainIn(int x0, int y0, int x1, int y1, std::vector<regiontile_t> &tiles, int low = -128, int high = 127) const ->std::size_t ;
+	auto artIn(int x0, int y0, int x1, int y1, std::vector<regiontile_t> &tiles, int low = -128, int high = 127) const ->std::size_t ;
+
+	//=========================================================================
+	// Visitors.  These walk the block storage directly, so there is no per
+	// tile block math, and each statics block is scanned once (not once per
+	// cell, as art(x,y) does).
+	//=========================================================================
+
+	//=========================================================================
+	// visit(xbase, ybase, const terrainview_t &, const artblock_t &) for every
+	// block, in block (mul) order
+	template <typename Visitor>
+	auto forEachBlock(Visitor &&visit) const ->void {
+		auto blocksdown = height/8 ;
+		for (auto block = 0 ; block < blockCount() ; ++block){
+			visit((block/blocksdown)*8, (block%blocksdown)*8, terrainblock(block), artblock(block));
+		}
+	}
+	//=========================================================================
+	// visit(xbase, ybase, terrain, art, otherterrain, otherart) for every block
+	// of this map and the same block of other, in block order.  The maps must
+	// be the same size.
+	template <typename Visitor>
+	auto forEachBlockWith(const uomap_t &other, Visitor &&visit) const ->void {
+		auto blocksdown = height/8 ;
+		for (auto block = 0 ; block < blockCount() ; ++block){
+			visit((block/blocksdown)*8, (block%blocksdown)*8, terrainblock(block), artblock(block), other.terrainblock(block), other.artblock(block));
+		}
+	}
+	//=========================================================================
+	// visit(x, y, tileid, altitude) for the terrain of each tile in the
+	// rectangle x0,y0 to x1,y1 (inclusive, clipped to the map) with an
+	// altitude from low to high, in block order (and y then x within a block).
+	// Blocks with no altitude in the range are passed over on their summary.
+	template <typename Visitor>
+	auto forEachTerrainIn(int x0, int y0, int x1, int y1, Visitor &&visit, int low = -128, int high = 127) const ->void {
+		auto everything = (low <= -128) && (high >= 127) ;
+		forEachBlockIn(x0, y0, x1, y1, [&](int block, int xbase, int ybase, int xfirst, int yfirst, int xlast, int ylast){
+			if (!everything){
+				const auto *summary = terrainSummary(block) ;
+				if ((summary != nullptr) && !summary->terrainBetween(low, high)){
+					return ;
+				}
+			}
+			const auto terrain = terrainblock(block) ;
+			for (auto y = yfirst ; y <= ylast ; ++y){
+				for (auto x = xfirst ; x <= xlast ; ++x){
+					auto [tileid,altitude] = terrain.terrain(x, y);
+					if ((altitude >= low) && (altitude <= high)){
+						visit(xbase+x, ybase+y, tileid, altitude);
+					}
+				}
+			}
+		});
+	}
+	//=========================================================================
+	// visit(x, y, const artrecord_t &) for each static in the rectangle x0,y0
+	// to x1,y1 (inclusive, clipped to the map) with an altitude from low to
+	// high, in block order (and file order within a block).  The records are
+	// read straight from the block, nothing is decoded ahead, and blocks with
+	// no statics in the range are passed over on their summary.
+	template <typename Visitor>
+	auto forEachArtIn(int x0, int y0, int x1, int y1, Visitor &&visit, int low = -128, int high = 127) const ->void {
+		forEachBlockIn(x0, y0, x1, y1, [&](int block, int xbase, int ybase, int xfirst, int yfirst, int xlast, int ylast){
+			const auto *summary = artSummary(block) ;
+			if ((summary != nullptr) && !summary->artBetween(low, high)){
+				return ;
+			}
+			const auto &art = artblock(block) ;
+			const auto *bytes = art.data() ;
+			auto count = art.size()/7 ;
+			for (std::size_t i = 0 ; i < count ; ++i, bytes += 7){
+				auto x = static_cast<int>(bytes[2]) ;
+				auto y = static_cast<int>(bytes[3]) ;
+				auto altitude = static_cast<std::int8_t>(bytes[4]) ;
+				if ((x < xfirst) || (x > xlast) || (y < yfirst) || (y > ylast) || (altitude < low) || (altitude > high)){
+					continue ;
+				}
+				auto record = artrecord_t{0,altitude,0} ;
+				std::memcpy(&record.tileid,bytes,2);
+				std::memcpy(&record.hue,bytes+5,2);
+				visit(xbase+x, ybase+y, record);
+			}
+		});
+	}
+
+	//=========================================================================
+	// visit(x, y, tileid, altitude, const artrecord_t *first, const artrecord_t *last)
+	// for every tile, in block order (and y then x within a block)
+	template <typename Visitor>
+	auto forEachTile(Visitor &&visit) const ->void {
+		auto records = std::vector<artrecord_t>() ;
+		auto offsets = artcells_t() ;
+		forEachBlock([&](int xbase, int ybase, const terrainview_t &terrain, const artblock_t &art){
+			records.clear();
+			art.cells(records, offsets);
+			for (auto y = 0 ; y < 8 ; ++y){
+				for (auto x = 0 ; x < 8 ; ++x){
+					auto cell = y*8 + x ;
+					auto [tileid,altitude] = terrain.terrain(x, y);
+					visit(xbase+x, ybase+y, tileid, altitude, records.data()+offsets[cell], records.data()+offsets[cell+1]);
+				}
+			}
+		});
+	}
+	//=========================================================================
+	// The same visit as forEachTile, but row major (y then x across the whole
+	// map), the order the command list is written in.  Each row of blocks is
+	// decoded once, and shared by its 8 rows of tiles.
+	template <typename Visitor>
+	auto forEachTileByRow(Visitor &&visit) const ->void {
+		forEachTileByRow(visit, [](std::size_t){return true;}, [](int, std::size_t){});
+	}
+	//=========================================================================
+	// As above, but a row of tiles is split in segments, the runs of tiles
+	// that are in the same section.  segment(y, section) is called at the start
+	// of each segment, and its tiles are only visited (or read in) if
+	// wanted(section).
+	template <typename Visitor, typename Wanted, typename Segment>
+	auto forEachTileByRow(Visitor &&visit, Wanted &&wanted, Segment &&segment) const ->void {
+		auto blocksacross = width/8 ;
+		auto blocksdown = height/8 ;
+		auto records = std::vector<artrecord_t>() ;
+		auto offsets = std::vector<artcells_t>(blocksacross) ;
+		for (auto blocky = 0 ; blocky < blocksdown ; ++blocky){
+			records.clear();
+			for (auto blockx = 0 ; blockx < blocksacross ; ++blockx){
+				auto block = blockx*blocksdown + blocky ;
+				if (wanted(static_cast<std::size_t>(block/sectionblocks))){
+					artblock(block).cells(records, offsets[blockx]);
+				}
+			}
+			for (auto y = 0 ; y < 8 ; ++y){
+				auto current = std::size_t(0) ;
+				auto use = false ;
+				for (auto blockx = 0 ; blockx < blocksacross ; ++blockx){
+					auto block = blockx*blocksdown + blocky ;
+					auto section = static_cast<std::size_t>(block/sectionblocks) ;
+					if ((blockx == 0) || (section != current)){
+						current = section ;
+						use = wanted(section) ;
+						segment(blocky*8+y, section);
+					}
+					if (!use){
+						continue ;
+					}
+					const auto terrain = terrainblock(block) ;
+					const auto &cells = offsets[blockx] ;
+					for (auto x = 0 ; x < 8 ; ++x){
+						auto cell = y*8 + x ;
+						auto [tileid,altitude] = terrain.terrain(x, y);
+						visit(blockx*8+x, blocky*8+y, tileid, altitude, records.data()+cells[cell], records.data()+cells[cell+1]);
+					}
+				}
+			}
+		}
+	}
 
 };
 
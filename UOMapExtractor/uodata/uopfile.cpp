@@ -2,6 +2,8 @@
 //
 
 #include "uopfile.hpp"
+#include "mappedfile.hpp"
+#include "parallel.hpp"
 
 #include <stdexcept>
 #include <cstdio>
@@ -11,6 +13,21 @@
 #include <cmath>
 #include <iomanip>
 #include <algorithm>
+#include <limits>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+#if defined(UOP_ZLIB)
+#include <zlib.h>
+#endif
+
+// SSE2 is there on every x64 build, elsewhere Adler32 is plain C++
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define UOMAP_ADLER_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace std::string_literals ;
 
@@ -122,26 +139,145 @@ auto uopindex_t::hashLittle2(const std::string& s) ->std::uint64_t{
 }
 //===========================================================
 auto uopindex_t::hashAdler32(const std::vector<std::uint8_t> &data) ->std::uint32_t {
-	std::uint32_t a = 1 ;
-	std::uint32_t b = 0 ;
-	for (const auto &entry : data ) {
-		a = (a + static_cast<std::uint32_t>(entry)) % 65521;
-		b = (b + a) % 65521 ;
+	return hashAdler32(data.data(), data.size());
+}
+//===========================================================
+auto uopindex_t::hashAdler32(const std::uint8_t *data, std::size_t size, std::uint32_t adler) ->std::uint32_t {
+	// The sums are only reduced every adler_nmax bytes, the most that can be
+	// added before b could overflow 32 bits (the same limit zlib uses)
+	constexpr std::uint32_t adler_base = 65521 ;
+	constexpr std::size_t adler_nmax = 5552 ;
+	std::uint32_t a = adler & 0xFFFF ;
+	std::uint32_t b = adler >> 16 ;
+	while (size > 0) {
+		auto chunk = std::min(size, adler_nmax) ;
+		size -= chunk ;
+#if defined(UOMAP_ADLER_SSE2)
+		// 16 bytes at a time.  For a chunk of n blocks, block k adds its byte
+		// sum to a, and to b its sum weighted 16..1 plus 16 times the byte sums
+		// of blocks 0..k (the running a, block by block).
+		auto blocks = chunk / 16 ;
+		if (blocks > 0) {
+			const auto zero = _mm_setzero_si128() ;
+			const auto weightslow = _mm_setr_epi16(16,15,14,13,12,11,10,9) ;
+			const auto weightshigh = _mm_setr_epi16(8,7,6,5,4,3,2,1) ;
+			auto sums = _mm_setzero_si128() ;
+			auto running = _mm_setzero_si128() ;
+			auto weighted = _mm_setzero_si128() ;
+			for (std::size_t block = 0 ; block < blocks ; ++block) {
+				auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)) ;
+				sums = _mm_add_epi32(sums, _mm_sad_epu8(bytes, zero)) ;
+				running = _mm_add_epi32(running, sums) ;
+				weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightslow)) ;
+				weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightshigh)) ;
+				data += 16 ;
+			}
+			std::uint32_t lanes[4] ;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums) ;
+			auto bytesum = static_cast<std::uint64_t>(lanes[0]) + lanes[2] ;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), running) ;
+			auto runningsum = static_cast<std::uint64_t>(lanes[0]) + lanes[2] ;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), weighted) ;
+			auto weightedsum = static_cast<std::uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3] ;
+			auto bvalue = static_cast<std::uint64_t>(b) + static_cast<std::uint64_t>(a) * blocks * 16 + runningsum * 16 + weightedsum ;
+			// The last block's running sum counted its bytes 16 times, which
+			// the weights already did
+			bvalue -= bytesum * 16 ;
+			a = static_cast<std::uint32_t>((a + bytesum) % adler_base) ;
+			b = static_cast<std::uint32_t>(bvalue % adler_base) ;
+			chunk -= blocks * 16 ;
+		}
+#endif
+		while (chunk >= 8) {
+			a += data[0] ; b += a ;
+			a += data[1] ; b += a ;
+			a += data[2] ; b += a ;
+			a += data[3] ; b += a ;
+			a += data[4] ; b += a ;
+			a += data[5] ; b += a ;
+			a += data[6] ; b += a ;
+			a += data[7] ; b += a ;
+			data += 8 ;
+			chunk -= 8 ;
+		}
+		while (chunk > 0) {
+			a += *data++ ;
+			b += a ;
+			--chunk ;
+		}
+		a %= adler_base ;
+		b %= adler_base ;
 	}
 	return (b<<16)| a ;
-	
 }
 
 //===========================================================
-auto uopindex_t::load(const std::string &hashstring, size_t max_index) ->void{
-	hashes.clear();
-	hashes.reserve(max_index);
-	if (!hashstring.empty() && (max_index>0)){
-		for (size_t i=0 ; i<= max_index;i++){
-			auto formatted = format(hashstring, i);
-			hashes.push_back(hashLittle2(formatted));
+uopindex_t::keytable_t::keytable_t(const std::string &hashstring, size_t max_index):slotmask(0){
+	if (hashstring.empty() || (max_index==0)){
+		return ;
+	}
+	hashes.reserve(max_index+1);
+	auto buffer = std::vector<char>(hashstring.size() + 32,0) ;
+	for (size_t i=0 ; i<= max_index;i++){
+		auto length = std::snprintf(buffer.data(), buffer.size(), hashstring.c_str(), static_cast<unsigned int>(i));
+		if (length < 0) {
+			length = 0 ;
 		}
+		hashes.push_back(hashLittle2(std::string(buffer.data(),std::min(static_cast<size_t>(length),buffer.size()-1))));
+	}
+	// Size the table to a power of two, at least twice the keys,
+	// so the probe sequences stay short
+	auto slots = size_t(16) ;
+	while (slots < hashes.size()*2){
+		slots <<= 1 ;
 	}
+	slotmask = slots - 1 ;
+	slotkeys.resize(slots,0);
+	slotindex.resize(slots,empty_slot);
+	for (size_t i=0 ; i < hashes.size();i++){
+		auto slot = static_cast<size_t>(hashes[i] ^ (hashes[i]>>32)) & slotmask ;
+		while (slotindex[slot] != empty_slot){
+			if (slotkeys[slot] == hashes[i]){
+				// Duplicate key, the first index wins (as the old linear search did)
+				break;
+			}
+			slot = (slot+1) & slotmask ;
+		}
+		if (slotindex[slot] == empty_slot){
+			slotkeys[slot] = hashes[i];
+			slotindex[slot] = static_cast<std::uint32_t>(i) ;
+		}
+	}
+}
+//===========================================================
+auto uopindex_t::keytable_t::find(std::uint64_t hash) const ->std::size_t {
+	if (slotindex.empty()){
+		return std::numeric_limits<std::size_t>::max();
+	}
+	auto slot = static_cast<size_t>(hash ^ (hash>>32)) & slotmask ;
+	while (slotindex[slot] != empty_slot){
+		if (slotkeys[slot] == hash){
+			return slotindex[slot] ;
+		}
+		slot = (slot+1) & slotmask ;
+	}
+	return std::numeric_limits<std::size_t>::max();
+}
+
+//===========================================================
+auto uopindex_t::load(const std::string &hashstring, size_t max_index) ->void{
+	// Generating the keys is a snprintf and hash per index, so we keep every
+	// table we have built around, keyed by the format (which already carries
+	// the map number) and the max index.
+	static std::mutex cachelock ;
+	static std::map<std::pair<std::string,size_t>,std::shared_ptr<const keytable_t>> cache ;
+	auto key = std::make_pair(hashstring,max_index) ;
+	auto lock = std::lock_guard<std::mutex>(cachelock) ;
+	auto iter = cache.find(key) ;
+	if (iter == cache.end()){
+		iter = cache.insert_or_assign(key,std::make_shared<const keytable_t>(hashstring,max_index)).first ;
+	}
+	table = iter->second ;
 }
 //===========================================================
 uopindex_t::uopindex_t(const std::string &hashstring, size_t max_index){
@@ -151,16 +287,18 @@ uopindex_t::uopindex_t(const std::string &hashstring, size_t max_index){
 }
 //===========================================================
 auto uopindex_t::operator[](std::uint64_t hash) const -> std::size_t{
-	auto iter = std::find(hashes.cbegin(),hashes.cend(),hash);
-	if (iter != hashes.cend()){
-		return std::distance(hashes.cbegin(), iter);
+	if (table == nullptr){
+		return std::numeric_limits<std::size_t>::max();
 	}
-	return std::numeric_limits<std::size_t>::max();
-	
+	return table->find(hash);
+}
+//===========================================================
+auto uopindex_t::size() const ->size_t {
+	return (table == nullptr)? 0 : table->hashes.size() ;
 }
 //===========================================================
 auto uopindex_t::clear() ->void {
-	hashes.clear();
+	table.reset();
 }
 
 
@@ -190,6 +328,28 @@ auto 	uopfile::table_entry::load(std::istream &input) ->uopfile::table_entry & {
 	return *this ;
 }
 //===============================================================
+auto 	uopfile::table_entry::load(const std::uint8_t *data) ->uopfile::table_entry & {
+	std::memcpy(&offset,data,sizeof(offset));
+	std::memcpy(&header_length,data+8,sizeof(header_length));
+	std::memcpy(&compressed_length,data+12,sizeof(compressed_length));
+	std::memcpy(&decompressed_length,data+16,sizeof(decompressed_length));
+	std::memcpy(&identifer,data+20,sizeof(identifer));
+	std::memcpy(&data_block_hash,data+28,sizeof(data_block_hash));
+	std::memcpy(&compression,data+32,sizeof(compression));
+	return *this ;
+}
+//===============================================================
+auto	uopfile::table_entry::save(std::uint8_t *data) const ->const table_entry & {
+	std::memcpy(data,&offset,sizeof(offset));
+	std::memcpy(data+8,&header_length,sizeof(header_length));
+	std::memcpy(data+12,&compressed_length,sizeof(compressed_length));
+	std::memcpy(data+16,&decompressed_length,sizeof(decompressed_length));
+	std::memcpy(data+20,&identifer,sizeof(identifer));
+	std::memcpy(data+28,&data_block_hash,sizeof(data_block_hash));
+	std::memcpy(data+32,&compression,sizeof(compression));
+	return *this ;
+}
+//===========================================================
 auto	uopfile::table_entry::save(std::ostream &output) ->uopfile::table_entry & {
 	output.write(reinterpret_cast<char*>(&offset),sizeof(offset));
 	output.write(reinterpret_cast<char*>(&header_length),sizeof(header_length));
@@ -206,37 +366,49 @@ auto	uopfile::table_entry::save(std::ostream &output) ->uopfile::table_entry & {
 /************************************************************************
  zlib wrappers for compression
  ***********************************************************************/
-// Modified version doesn't compress
-/*
 //=============================================================================
-auto uopfile::zdecompress(const std::vector<uint8_t> &source, std::size_t decompressed_size) const ->std::vector<uint8_t>{
-	
+auto uopfile::zlibAvailable() ->bool {
+#if defined(UOP_ZLIB)
+	return true ;
+#else
+	return false ;
+#endif
+}
+//=============================================================================
+auto uopfile::zdecompress([[maybe_unused]] const std::uint8_t *source, [[maybe_unused]] std::size_t size, [[maybe_unused]] std::size_t decompressed_size, std::vector<std::uint8_t> &dest) ->bool {
+#if defined(UOP_ZLIB)
 	// uLongf is from zlib.h
-	auto srcsize = static_cast<uLongf>(source.size()) ;
+	auto srcsize = static_cast<uLong>(size) ;
 	auto destsize = static_cast<uLongf>(decompressed_size);
-	std::vector<uint8_t> dest(decompressed_size,0);
-	auto status = uncompress2(dest.data(), &destsize, source.data(), &srcsize);
-	if (status != Z_OK){
+	dest.resize(decompressed_size);
+	auto status = uncompress2(dest.data(), &destsize, source, &srcsize);
+	if ((status != Z_OK) || (destsize != decompressed_size)){
 		dest.clear() ;
-		dest.resize(0) ;
-		return dest ;
+		return false ;
 	}
-	dest.resize(destsize);
-	return dest ;
+	return true ;
+#else
+	dest.clear();
+	return false ;
+#endif
 }
 //=============================================================================
-auto uopfile::zcompress(const std::vector<uint8_t> &source) const ->std::vector<uint8_t>{
-	auto size = compressBound(static_cast<uLong>(source.size()));
-	std::vector<uint8_t> rdata(size,0);
-	auto status = compress2(reinterpret_cast<Bytef*>(rdata.data()), &size, reinterpret_cast<const Bytef*>(source.data()), static_cast<uLongf>(source.size()),Z_DEFAULT_COMPRESSION);
+auto uopfile::zcompress([[maybe_unused]] const std::uint8_t *source, [[maybe_unused]] std::size_t size, [[maybe_unused]] int level, std::vector<std::uint8_t> &dest) ->bool {
+#if defined(UOP_ZLIB)
+	auto destsize = compressBound(static_cast<uLong>(size));
+	dest.resize(destsize);
+	auto status = compress2(dest.data(), &destsize, source, static_cast<uLong>(size), level);
 	if (status != Z_OK){
-		rdata.clear();
-		return rdata ;
+		dest.clear();
+		return false ;
 	}
-	rdata.resize(size) ;
-	return rdata;
+	dest.resize(destsize) ;
+	return true ;
+#else
+	dest.clear();
+	return false ;
+#endif
 }
-*/
 
 //=============================================================================
 auto uopfile::isUOP(const std::string &filepath) const ->bool {
@@ -259,7 +431,7 @@ auto uopfile::isUOP(const std::string &filepath) const ->bool {
 
 //===============================================================
 //===============================================================
-auto uopfile::nonIndexHash(std::uint64_t hash, std::size_t entry, std::vector<std::uint8_t> &data) ->bool{
+auto uopfile::nonIndexHash(std::uint64_t hash, std::size_t entry, const std::uint8_t *data, std::size_t) ->bool{
 	auto fill = std::cerr.fill() ;
 	
 	std::cerr << "Hashlookup failed for entry "s << entry << " with a hash of " <<std::showbase << std::hex << std::setfill('0') << std::setw(16)<<hash<<std::dec <<std::noshowbase <<std::setfill(fill)<<std::setw(0)<<std::endl;
@@ -267,98 +439,223 @@ auto uopfile::nonIndexHash(std::uint64_t hash, std::size_t entry, std::vector<st
 }
 
 //===============================================================
-auto uopfile::loadUOP(const std::string &filepath, std::size_t max_hashindex , const std::string &hashformat1, const std::string &hashformat2 )->bool{
-	std::ifstream input(filepath, std::ios::binary);
-	if (!input.is_open()){
+// Reads the header and every table entry of the mapped file
+auto uopfile::readTable(const std::uint8_t *base, std::size_t filesize, std::vector<table_entry> &entries) ->bool {
+	entries.clear();
+	if (filesize < 0x1C) {
 		return false ;
 	}
 	// Make sure this is a format and version we understand
 	std::uint32_t sig  = 0 ;
 	std::uint32_t version = 0 ;
-	input.read(reinterpret_cast<char*>(&sig),sizeof(sig));
-	input.read(reinterpret_cast<char*>(&version),sizeof(version));
-	input.seekg(4,std::ios::cur);
+	std::memcpy(&sig,base,sizeof(sig));
+	std::memcpy(&version,base+4,sizeof(version));
 	if ((version > _uop_version) || (sig != _uop_identifer)){
 		return false ;
 	}
-	auto hashstorage1 = uopindex_t(hashformat1,max_hashindex);
-	auto hashstorage2 = uopindex_t(hashformat2,max_hashindex);
-	
 	std::uint64_t table_offset = 0;
 	std::uint32_t tablesize = 0 ;
 	std::uint32_t maxentry = 0 ;
-	input.read(reinterpret_cast<char*>(&table_offset),sizeof(table_offset));
-	input.read(reinterpret_cast<char*>(&tablesize),sizeof(tablesize));
-	input.read(reinterpret_cast<char*>(&maxentry),sizeof(maxentry));
+	std::memcpy(&table_offset,base+12,sizeof(table_offset));
+	std::memcpy(&tablesize,base+20,sizeof(tablesize));
+	std::memcpy(&maxentry,base+24,sizeof(maxentry));
 	
 	// Read the table entries
-	input.seekg(table_offset,std::ios::beg) ;
-	std::vector<table_entry> entries ;
 	entries.reserve(maxentry);
-	while ((table_offset!= 0) && (!input.eof()) && input.good()){
-		input.read(reinterpret_cast<char*>(&tablesize),sizeof(tablesize));
-		input.read(reinterpret_cast<char*>(&table_offset),sizeof(table_offset));
+	while ((table_offset!= 0) && (table_offset + 12 <= filesize)){
+		const auto *table = base + table_offset ;
+		std::memcpy(&tablesize,table,sizeof(tablesize));
+		std::memcpy(&table_offset,table+4,sizeof(table_offset));
+		table += 12 ;
 		for (std::uint32_t i=0 ;i < tablesize;i++){
+			if (table + table_entry::_entry_size > base + filesize){
+				break;
+			}
 			table_entry entry ;
-			entry.load(input);
+			entry.load(table);
 			entries.push_back(entry);
+			table += table_entry::_entry_size ;
 		}
-		if ((table_offset!=0) && (!input.eof()) && input.good()){
-			input.seekg(table_offset,std::ios::beg);
+	}
+	return true ;
+}
+
+//===============================================================
+auto uopfile::verifyEntries(const std::uint8_t *base, std::size_t filesize, const std::vector<table_entry> &entries, unsigned int jobs) ->bool {
+	constexpr auto none = std::numeric_limits<std::size_t>::max() ;
+	auto failed = std::atomic<std::size_t>(none) ;
+	parallel::forEach(entries.size(), jobs, [&](std::size_t current_entry){
+		const auto &entry = entries[current_entry] ;
+		if ((entry.identifer == 0 ) || (entry.compressed_length == 0) || (entry.data_block_hash == 0)) {
+			return ;
+		}
+		auto start = static_cast<std::uint64_t>(entry.offset) + entry.header_length ;
+		auto size = static_cast<std::size_t>((entry.compression==0)?entry.decompressed_length : entry.compressed_length) ;
+		// Out of bounds entries are failed by the caller
+		if ((entry.offset < 0) || (start + size > filesize)) {
+			return ;
 		}
+		if (uopindex_t::hashAdler32(base + start, size) != entry.data_block_hash){
+			auto expected = none ;
+			failed.compare_exchange_strong(expected, current_entry);
+		}
+	});
+	if (failed != none){
+		std::cerr << "Data hash mismatch for entry "s << failed.load() << std::endl;
+		return false ;
+	}
+	return true ;
+}
+
+//===============================================================
+auto uopfile::loadUOPDirectory(const mappedfile_t &input, std::size_t max_hashindex, const std::string &hashformat1, const std::string &hashformat2, std::vector<uopentry_t> &directory) const ->bool {
+	directory.clear();
+	auto entries = std::vector<table_entry>() ;
+	if (!input.is_open() || !readTable(input.data(), input.size(), entries)){
+		return false ;
 	}
-	auto current_entry = 0 ;
-	//std::cout <<"Number of entries: " << entries.size()<<std::endl;
-	for (auto &entry : entries){
-		// Now loop through entries
-		if ((entry.identifer != 0 ) && (entry.compressed_length != 0)) {
-			input.seekg(entry.offset+entry.header_length,std::ios::beg) ;
-			auto size = (entry.compression==0)?entry.decompressed_length : entry.compressed_length ;
-			std::vector<std::uint8_t> uopdata(size,0);
-			input.read(reinterpret_cast<char*>(uopdata.data()),size);
+	if (_verify && !verifyEntries(input.data(), input.size(), entries, _jobs)){
+		return false ;
+	}
+	auto hashstorage1 = uopindex_t(hashformat1,max_hashindex);
+	auto hashstorage2 = uopindex_t(hashformat2,max_hashindex);
+	directory.reserve(entries.size());
+	for (std::size_t current_entry = 0 ; current_entry < entries.size() ; ++current_entry){
+		const auto &entry = entries[current_entry] ;
+		if ((entry.identifer == 0 ) || (entry.compressed_length == 0)) {
+			continue ;
+		}
+		auto start = static_cast<std::uint64_t>(entry.offset) + entry.header_length ;
+		auto size = (entry.compression==0)?entry.decompressed_length : entry.compressed_length ;
+		if ((entry.offset < 0) || (start + size > input.size())) {
+			return false ;
+		}
+		auto index = hashstorage1[entry.identifer];
+		if (index == std::numeric_limits<std::size_t>::max()){
+			index = hashstorage2[entry.identifer];
+		}
+		directory.push_back(uopentry_t{current_entry,index,start,size,entry.decompressed_length,entry.identifer,entry.data_block_hash,entry.compression});
+	}
+	return true ;
+}
+
+//===============================================================
+auto uopfile::loadUOP(const std::string &filepath, std::size_t max_hashindex , const std::string &hashformat1, const std::string &hashformat2 )->bool{
+	// We map the file, and hand each entry to the hooks as a view into the
+	// mapping, so there is no per entry buffer (or copy) on the way through,
+	// other than to inflate a compressed entry.
+	auto phase = phasestats_t::scope_t(_stats, "loadUOP") ;
+	auto input = mappedfile_t(filepath);
+	if (!input.is_open()){
+		return false ;
+	}
+	const auto *base = input.data() ;
+	const auto filesize = input.size() ;
+	phase.counters().bytesread += filesize ;
+	auto entries = std::vector<table_entry>() ;
+	if (!readTable(base, filesize, entries)){
+		return false ;
+	}
+	if (_verify && !verifyEntries(base, filesize, entries, _jobs)){
+		return false ;
+	}
+	auto hashstorage1 = uopindex_t(hashformat1,max_hashindex);
+	auto hashstorage2 = uopindex_t(hashformat2,max_hashindex);
+	
+	// Compressed entries are inflated a window at a time, in parallel, into
+	// our buffers, and then every entry goes to the hooks in entry order
+	auto window = static_cast<std::size_t>((_jobs == 0) ? parallel::threads() : _jobs) * 4 ;
+	auto inflated = std::vector<std::vector<std::uint8_t>>(window) ;
+	for (std::size_t first = 0 ; first < entries.size() ; first += window){
+		auto last = std::min(first + window, entries.size()) ;
+		auto compressed = false ;
+		for (auto current_entry = first ; current_entry < last ; ++current_entry){
+			const auto &entry = entries[current_entry] ;
+			if ((entry.identifer != 0 ) && (entry.compressed_length != 0)) {
+				auto start = static_cast<std::uint64_t>(entry.offset) + entry.header_length ;
+				auto size = static_cast<std::size_t>((entry.compression==0)?entry.decompressed_length : entry.compressed_length) ;
+				if ((entry.offset < 0) || (start + size > filesize)) {
+					return false ;
+				}
+				compressed = compressed || (entry.compression == 1) ;
+			}
+		}
+		if (compressed){
+			auto failed = std::atomic<std::size_t>(std::numeric_limits<std::size_t>::max()) ;
+			parallel::forEach(last - first, _jobs, [&](std::size_t slot){
+				const auto &entry = entries[first + slot] ;
+				if ((entry.identifer == 0 ) || (entry.compressed_length == 0) || (entry.compression != 1)) {
+					return ;
+				}
+				auto start = static_cast<std::uint64_t>(entry.offset) + entry.header_length ;
+				if (!zdecompress(base + start, entry.compressed_length, entry.decompressed_length, inflated[slot])){
+					auto expected = std::numeric_limits<std::size_t>::max() ;
+					failed.compare_exchange_strong(expected, first + slot);
+				}
+			});
+			if (failed != std::numeric_limits<std::size_t>::max()){
+				std::cerr << "Unable to decompress entry "s << failed.load() << std::endl;
+				return false ;
+			}
+		}
+		for (auto current_entry = first ; current_entry < last ; ++current_entry){
+			const auto &entry = entries[current_entry] ;
+			if ((entry.identifer == 0 ) || (entry.compressed_length == 0)) {
+				continue ;
+			}
+			auto start = static_cast<std::uint64_t>(entry.offset) + entry.header_length ;
+			const auto *uopdata = base + start ;
+			auto size = static_cast<std::size_t>((entry.compression==0)?entry.decompressed_length : entry.compressed_length) ;
 			if (entry.compression == 1){
-				// Modified, should never be compressing with this uopfile version
-				throw std::runtime_error("Compression called, should never happen");
-				//uopdata = zdecompress(uopdata, entry.decompressed_length);
+				const auto &buffer = inflated[current_entry - first] ;
+				uopdata = buffer.data() ;
+				size = buffer.size() ;
 			}
 			
+			++phase.counters().entries ;
 			// First see if we should even do anything with this hash
-			if (processHash(entry.identifer, current_entry, uopdata)) {
+			if (processHash(entry.identifer, current_entry, uopdata, size)) {
 				// Yes, we should!
 				// Can we find an index?
-				
-				
 				auto 	index = hashstorage1[entry.identifer];
 				if (index == std::numeric_limits<std::size_t>::max()){
-					
 					index = hashstorage2[entry.identifer];
 				}
 				if (index == std::numeric_limits<std::size_t>::max()){
-					
-					if (!nonIndexHash(entry.identifer, current_entry, uopdata)){
+					if (!nonIndexHash(entry.identifer, current_entry, uopdata, size)){
 						return false ;
 					}
 				}
 				
-				processEntry(current_entry, index, uopdata);
+				processEntry(current_entry, index, uopdata, size);
 			}
 		}
-		current_entry++ ;
 	}
 	return endUOPProcessing();
 }
 //==============================================================================
+auto uopfile::entrySpan(int entry, std::vector<std::uint8_t> &scratch) ->std::pair<const std::uint8_t*,std::size_t> {
+	scratch = entryForWrite(entry) ;
+	return std::make_pair(scratch.data(), scratch.size());
+}
+//==============================================================================
 auto uopfile::writeUOP(const std::string &filepath) ->bool {
 	static constexpr std::int32_t table_size = 100 ;
 	static constexpr std::int64_t first_table = 0x200 ;
 	static constexpr std::uint32_t timestamp = 0xFD23EC43 ;
-	static constexpr char pad = 0 ;
 	static constexpr std::int32_t zero = 0 ;
-	static constexpr std::int64_t bigzero = 0 ;
 	static constexpr std::int32_t one = 1 ;
-	auto blanktable = std::vector<char>(table_entry::_entry_size*table_size,0) ;
-	auto compress = static_cast<std::uint16_t>(writeCompress());
-	std::vector<unsigned char> emptyTableEntry(table_entry::_entry_size,0);
+	static constexpr std::uint64_t table_header = 12 ;
+	auto compress = writeCompress() ;
+#if defined(UOP_ZLIB)
+	auto level = (_compression == 0) ? Z_DEFAULT_COMPRESSION : _compression ;
+#else
+	auto level = _compression ;
+	if (compress){
+		std::cerr << "Unable to compress "s << filepath << ", built without zlib"s << std::endl;
+		return false ;
+	}
+#endif
 	auto number_of_entries = entriesToWrite() ;
 	
 	// First can we even open the file
@@ -366,89 +663,88 @@ auto uopfile::writeUOP(const std::string &filepath) ->bool {
 	if (!output.is_open()){
 		return false ;
 	}
-	// write out the signature and version
-	output.write(reinterpret_cast<const char*>(&_uop_identifer), sizeof(_uop_identifer));
-	output.write(reinterpret_cast<const char*>(&_uop_version), sizeof(_uop_version));
-	output.write(reinterpret_cast<const char*>(&timestamp), sizeof(timestamp));
+	// The header, padded out to the first table
+	auto header = std::vector<char>(first_table,0) ;
+	std::memcpy(header.data(),&_uop_identifer,4);
+	std::memcpy(header.data()+4,&_uop_version,4);
+	std::memcpy(header.data()+8,&timestamp,4);
+	std::memcpy(header.data()+12,&first_table,8);
+	std::memcpy(header.data()+20,&table_size,4);
+	std::memcpy(header.data()+24,&number_of_entries,4);
+	std::memcpy(header.data()+28,&one,4);
+	std::memcpy(header.data()+32,&one,4);
+	std::memcpy(header.data()+36,&zero,4);
+	output.write(header.data(),header.size());
 	
-	output.write(reinterpret_cast<const char*>(&first_table),sizeof(first_table));
-	output.write(reinterpret_cast<const char*>(&table_size),sizeof(table_size));
-	output.write(reinterpret_cast<char*>(&number_of_entries),sizeof(number_of_entries));
-	output.write(reinterpret_cast<const char*>(&one),sizeof(one));
-	output.write(reinterpret_cast<const char*>(&one),sizeof(one));
-	output.write(reinterpret_cast<const char*>(&zero),sizeof(zero));
-	for (auto i = 0x28; i < first_table;++i){
-		output.write(&pad,sizeof(pad));
-	}
 	auto number_tables = number_of_entries/table_size + (((number_of_entries%table_size) > 0)?1:0);
 	
+	// A table at a time: the entries are gathered (as views where the
+	// subclass can, see entrySpan), deflated (if compressing) and hashed in
+	// parallel, and then as every size is known the table goes out in one
+	// pass with its data behind it
+	auto spans = std::vector<std::pair<const std::uint8_t*,std::size_t>>(table_size) ;
+	auto scratch = std::vector<std::vector<std::uint8_t>>(table_size) ;
+	auto deflated = std::vector<std::vector<std::uint8_t>>(compress ? table_size : 0) ;
+	auto sizes = std::vector<std::uint32_t>(table_size) ;
 	auto tables = std::vector<table_entry>(table_size);
-	// We are going to write place holders for our table,
-	// and then the data
+	auto tabledata = std::vector<char>(table_header + table_entry::_entry_size*table_size) ;
+	auto current_table = static_cast<std::uint64_t>(first_table) ;
 	for (auto i = 0 ; i< number_tables ; ++i){
-		std::uint64_t current_table = output.tellp() ;
 		auto idxStart = i * table_size ;
 		auto idxEnd = std::min(((i+1) * table_size),number_of_entries) ;
 		int delta = idxEnd - idxStart ;
-		output.write(reinterpret_cast<char*>(&delta),sizeof(delta)); // files are in this block
-		output.write(reinterpret_cast<const char*>(&bigzero),sizeof(bigzero)); // next table, fill in later
-		// we need to write out a dummy table
-		output.write(blanktable.data(),blanktable.size());
-		// now we will create our table in memory, and write out data at the same time
-		// data
-		int data_entry = 0 ;
-		for (int j= idxStart;j<idxEnd; ++j,++data_entry){
-			auto rawdata = entryForWrite(j);
-			
-			unsigned int sizeDecompressed = static_cast<unsigned int>(rawdata.size()) ;
-			unsigned int sizeOut = sizeDecompressed ;
-			if ((compress != 0) && (sizeDecompressed>0)){
-				// Modified version, we should never be compressing
-				throw std::runtime_error("Should never be compressing in this version ");
-				//auto dataout = this->zcompress(rawdata) ;
-				//sizeOut = static_cast<unsigned int>(dataout.size()) ;
-				//rawdata = dataout ;
-			}
-			tables[data_entry].offset = output.tellp() ;
-			tables[data_entry].compression = compress ;
-			tables[data_entry].compressed_length = sizeOut ;
-			tables[data_entry].decompressed_length = sizeDecompressed ;
-			auto hashkey = writeHash(data_entry + i*table_size);
-			tables[data_entry].identifer =  uopindex_t::hashLittle2(hashkey);
-			
-			if (sizeDecompressed>0){
-				tables[data_entry].data_block_hash = uopindex_t::hashAdler32(rawdata);
-				// write out the data
-				output.write(reinterpret_cast<char*>(rawdata.data()),rawdata.size());
-			}
+		for (auto j = 0 ; j < delta ; ++j){
+			spans[j] = entrySpan(idxStart + j, scratch[j]) ;
 		}
-		std::uint64_t nextTable = output.tellp() ;
-		// Go back and fix the table header
-		if (i < number_tables -1){
-			output.seekp(current_table + 4,std::ios::beg);
-			output.write(reinterpret_cast<char*>(&nextTable),sizeof(nextTable));
-			
+		auto failed = std::atomic<bool>(false) ;
+		parallel::forEach(static_cast<std::size_t>(delta), _jobs, [&](std::size_t j){
+			auto &[data,size] = spans[j] ;
+			sizes[j] = static_cast<std::uint32_t>(size) ;
+			tables[j].compression = 0 ;
+			if (compress && (size > 0)){
+				if (!zcompress(data, size, level, deflated[j])){
+					failed = true ;
+					return ;
+				}
+				// The hash is of the data as stored
+				if (deflated[j].size() < size){
+					data = deflated[j].data() ;
+					size = deflated[j].size() ;
+					tables[j].compression = 1 ;
+				}
+			}
+			tables[j].data_block_hash = (size > 0) ? uopindex_t::hashAdler32(data, size) : 0 ;
+		});
+		if (failed){
+			std::cerr << "Unable to compress "s << filepath << std::endl;
+			return false ;
 		}
-		else {
-			output.seekp(current_table + 12,std::ios::beg); // We need to fix the next table address
+		auto offset = current_table + tabledata.size() ;
+		for (auto j = 0 ; j < delta ; ++j){
+			auto size = static_cast<std::uint32_t>(spans[j].second) ;
+			tables[j].offset = static_cast<std::int64_t>(offset) ;
+			tables[j].header_length = 0 ;
+			tables[j].compressed_length = size ;
+			tables[j].decompressed_length = sizes[j] ;
+			tables[j].identifer = uopindex_t::hashLittle2(writeHash(idxStart + j));
+			offset += size ;
 		}
-		auto table_entry = 0 ;
-		for (int j=idxStart;j<idxEnd;++j,++table_entry ){
-			output.write(reinterpret_cast<char*>(&tables[table_entry].offset),sizeof(tables[table_entry].offset));
-			output.write(reinterpret_cast<const char*>(&zero),sizeof(zero));
-			output.write(reinterpret_cast<char*>(&tables[table_entry].compressed_length),sizeof(tables[table_entry].compressed_length));
-			output.write(reinterpret_cast<char*>(&tables[table_entry].decompressed_length),sizeof(tables[table_entry].decompressed_length));
-			output.write(reinterpret_cast<char*>(&tables[table_entry].identifer),sizeof(tables[table_entry].identifer));
-			output.write(reinterpret_cast<char*>(&tables[table_entry].data_block_hash),sizeof(tables[table_entry].data_block_hash));
-			output.write(reinterpret_cast<char*>(&tables[table_entry].compression),sizeof(tables[table_entry].compression));
-			
+		// The last table has no next
+		auto nextTable = (i < number_tables -1) ? offset : std::uint64_t(0) ;
+		std::fill(tabledata.begin(),tabledata.end(),0);
+		std::memcpy(tabledata.data(),&delta,4);
+		std::memcpy(tabledata.data()+4,&nextTable,8);
+		for (auto j = 0 ; j < delta ; ++j){
+			tables[j].save(reinterpret_cast<std::uint8_t*>(tabledata.data()) + table_header + j*table_entry::_entry_size);
 		}
-		// Fill the remainder with entry entries
-		for (;table_entry < table_size;++table_entry){
-			output.write(reinterpret_cast<const char*>(emptyTableEntry.data()),emptyTableEntry.size());
+		output.write(tabledata.data(),tabledata.size());
+		for (auto j = 0 ; j < delta ; ++j){
+			if (spans[j].second > 0){
+				output.write(reinterpret_cast<const char*>(spans[j].first),static_cast<std::streamsize>(spans[j].second));
+			}
 		}
-		output.seekp(nextTable,std::ios::beg);
+		current_table = offset ;
 	}
-	return true ;
+	return output.good() ;
 }
 
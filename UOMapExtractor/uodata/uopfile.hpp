@@ -130,24 +130,46 @@
 #include <vector>
 #include <memory>
 #include <cstdio>
+#include <limits>
+#include <utility>
 
-// This is modified, in that we are only using it for a map
-// Which is not compressed, so we can simplify and
-// not include zlib
-//#include <zlib.h>
+#include "mappedfile.hpp"
+#include "phasestats.hpp"
+
+// zlib is optional, as a map is never compressed.  Build with UOP_ZLIB defined
+// (and link zlib) to read or write compressed entries, without it they fail
+// the load (or the write).
 
 //===========================================================
 // uopindex_t
 //===========================================================
 //===========================================================
 struct uopindex_t {
-	std::vector<std::uint64_t> hashes ;
+	//===========================================================
+	// The generated keys for a hash format, and an open addressed
+	// table to go from a key back to its index.  These are built once
+	// per hash format/max index, and shared by every uopindex_t
+	// (and thread) that asks for the same one.
+	struct keytable_t {
+		static constexpr auto empty_slot = std::numeric_limits<std::uint32_t>::max() ;
+		std::vector<std::uint64_t> hashes ;
+		std::vector<std::uint64_t> slotkeys ;
+		std::vector<std::uint32_t> slotindex ;
+		std::size_t slotmask ;
+		keytable_t(const std::string &hashstring, size_t max_index) ;
+		auto find(std::uint64_t hash) const ->std::size_t ;
+	};
+	std::shared_ptr<const keytable_t> table ;
+	
 	static auto hashLittle2(const std::string& s) ->std::uint64_t;
 	static auto hashAdler32(const std::vector<std::uint8_t> &data) ->std::uint32_t ;
+	// Continues adler (so a hash can be built up over several pieces)
+	static auto hashAdler32(const std::uint8_t *data, std::size_t size, std::uint32_t adler = 1) ->std::uint32_t ;
 	
 	auto load(const std::string &hashstring, size_t max_index) ->void;
 	uopindex_t(const std::string &hashstring="", size_t max_index=0);
 	auto operator[](std::uint64_t hash) const -> size_t ;
+	auto size() const ->size_t ;
 	auto clear() ->void ;
 	//==========================================================
 	// The source for this was found on StackOverflow at:
@@ -189,7 +211,9 @@ private:
 		std::int16_t	compression ;
 		table_entry();
 		auto 	load(std::istream &input) ->table_entry & ;
+		auto 	load(const std::uint8_t *data) ->table_entry & ;
 		auto	save(std::ostream &output) ->table_entry & ;
+		auto	save(std::uint8_t *data) const ->const table_entry & ;
 		// 34 bytes for a table entry
 		/*********************** Constants used ******************/
 		static constexpr unsigned int _entry_size = 34 ;
@@ -198,13 +222,20 @@ private:
 	
 	std::vector<std::uint64_t> _hash1 ;
 	std::vector<std::uint64_t> _hash2 ;
+	bool _verify = false ;
+	int _compression = 0 ;
+	unsigned int _jobs = 0 ;
+	phasestats_t *_stats = nullptr ;
+	
+	static auto readTable(const std::uint8_t *base, std::size_t filesize, std::vector<table_entry> &entries) ->bool ;
+	// Checks the data of every entry against its data_block_hash (those with
+	// one), spread over up to jobs threads (0 for one per hardware thread)
+	static auto verifyEntries(const std::uint8_t *base, std::size_t filesize, const std::vector<table_entry> &entries, unsigned int jobs) ->bool ;
 	
 	/****************** zlib compression wrappers *********************/
-// Modified version, no zlib
-	/*
-	auto zcompress(const std::vector<std::uint8_t> &data) const ->std::vector<unsigned char>;
-	auto zdecompress(const std::vector<std::uint8_t> &source, std::size_t decompressed_size) const ->std::vector<unsigned char>;
-	*/
+	// Deflates size bytes at source into dest at level (a zlib level), false
+	// if it can't (or there is no zlib)
+	static auto zcompress(const std::uint8_t *source, std::size_t size, int level, std::vector<std::uint8_t> &dest) ->bool ;
 	
 	
 	
@@ -212,20 +243,51 @@ protected:
 	//==============================================================================
 	// Virtual routines, modify based on uop file processing
 	//==============================================================================
-	virtual auto processEntry(std::size_t entry, std::size_t index, std::vector<std::uint8_t> &data) ->bool {return true;}
-	virtual auto processHash(std::uint64_t hash,std::size_t entry , std::vector<std::uint8_t> &data) ->bool {return true;}
-	virtual auto nonIndexHash(std::uint64_t hash, std::size_t entry, std::vector<std::uint8_t> &data)->bool;
+	// The data handed to the entry hooks is a read only view into the mapped uop
+	// file (or for a compressed entry, into the inflated copy), it is only valid
+	// for the duration of the call.
+	virtual auto processEntry(std::size_t entry, std::size_t index, const std::uint8_t *data, std::size_t /*size*/) ->bool {return true;}
+	virtual auto processHash(std::uint64_t hash,std::size_t entry , const std::uint8_t *data, std::size_t /*size*/) ->bool {return true;}
+	virtual auto nonIndexHash(std::uint64_t hash, std::size_t entry, const std::uint8_t *data, std::size_t size)->bool;
 	virtual auto endUOPProcessing() ->bool {return true ;};
 	
 	virtual auto entriesToWrite()const ->int {return 0;}
-	virtual auto writeCompress() const ->bool {return false ;}
+	// Whether writeUOP deflates the entries, by default if a compression
+	// level has been set
+	virtual auto writeCompress() const ->bool {return _compression != 0 ;}
 	virtual auto entryForWrite(int entry)->std::vector<unsigned char>{return std::vector<unsigned char>();}
+	// The data of an entry to write, as a view that must stay valid until
+	// writeUOP returns, or is put in scratch.  Entries are asked for in order,
+	// on the writing thread.  The default is entryForWrite, into scratch.
+	virtual auto entrySpan(int entry, std::vector<std::uint8_t> &scratch) ->std::pair<const std::uint8_t*,std::size_t> ;
 	virtual auto writeHash(int entry)->std::string{return std::string();} ;
 	//========================================================================
 	auto isUOP(const std::string &filepath) const ->bool ;
 	
 	auto loadUOP(const std::string &filepath, std::size_t max_hashindex, const std::string &hashformat1,const std::string &hashformat2 ="") ->bool ;
 	
+	//==========================================================
+	// Where each entry's data is in the file, for those that want to read
+	// the entries themselves (and later) rather than through the hooks.
+	// index is from the hash formats, std::numeric_limits<std::size_t>::max()
+	// if neither matched.  Only entries with data are listed.
+	struct uopentry_t {
+		std::size_t		entry ;				// Position in the table
+		std::size_t		index ;
+		std::uint64_t	offset ;			// Of the data (past the entry header)
+		std::uint32_t	length ;			// Of the data as stored
+		std::uint32_t	decompressed_length ;
+		std::uint64_t	hash ;
+		std::uint32_t	data_block_hash ;
+		std::int16_t	compression ;
+	};
+	auto loadUOPDirectory(const mappedfile_t &input, std::size_t max_hashindex, const std::string &hashformat1, const std::string &hashformat2, std::vector<uopentry_t> &directory) const ->bool ;
+	// Whether this was built with zlib (so compressed entries can be read)
+	static auto zlibAvailable() ->bool ;
+	// Inflates size bytes at source into dest (resized to decompressed_size),
+	// false if it isn't valid zlib data of that size (or there is no zlib)
+	static auto zdecompress(const std::uint8_t *source, std::size_t size, std::size_t decompressed_size, std::vector<std::uint8_t> &dest) ->bool ;
+	
 	auto writeUOP(const std::string &filepath)  ->bool ;
 	//==========================================================
 	// The source for this was found on StackOverflow at:
@@ -248,6 +310,24 @@ protected:
 	
 public:
 	virtual ~uopfile() = default ;
+	// Check the entry data against the stored hashes on load (a mismatch
+	// fails the load).  Off by default.
+	auto verify(bool state) ->void {_verify = state;}
+	auto verify() const ->bool {return _verify;}
+	// The zlib level (1 fastest to 9 smallest, -1 zlib's default) writeUOP
+	// deflates the entries at, 0 (the default) writes them as is.  An entry
+	// that doesn't get smaller is written as is regardless.
+	auto compression(int level) ->void {_compression = level;}
+	auto compression() const ->int {return _compression;}
+	// The threads a load or write may spread its work over, 0 (the default)
+	// for one per hardware thread.  Set it lower when several files are
+	// worked on at once, so they share the machine rather than each take it.
+	auto jobs(unsigned int count) ->void {_jobs = count;}
+	auto jobs() const ->unsigned int {return _jobs;}
+	// Where the loads record their phases (see phasestats.hpp), none (the
+	// default) if null.  It has to outlive the loads.
+	auto stats(phasestats_t *stats) ->void {_stats = stats;}
+	auto stats() const ->phasestats_t* {return _stats;}
 	
 };
 #endif /* uopfile_hpp */
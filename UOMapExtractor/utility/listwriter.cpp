@@ -0,0 +1,87 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "listwriter.hpp"
+
+#include <cstring>
+
+//=================================================================================
+listwriter_t::listwriter_t(std::size_t buffersize) :buffer(std::max<std::size_t>(buffersize,1024)),used(0),flushed(0) {
+}
+//=================================================================================
+listwriter_t::listwriter_t(const std::string &filepath, std::size_t buffersize) :listwriter_t(buffersize) {
+	open(filepath);
+}
+//=================================================================================
+listwriter_t::~listwriter_t() {
+	close();
+}
+
+//=================================================================================
+auto listwriter_t::open(const std::string &filepath) ->bool {
+	close();
+	// Text mode, so the line endings match what std::ofstream always gave us
+	output.open(filepath) ;
+	flushed = 0 ;
+	return output.is_open() ;
+}
+//=================================================================================
+auto listwriter_t::is_open() const ->bool {
+	return output.is_open() ;
+}
+//=================================================================================
+auto listwriter_t::good() const ->bool {
+	return output.good() ;
+}
+//=================================================================================
+auto listwriter_t::flush() ->bool {
+	if (used > 0) {
+		output.write(buffer.data(), static_cast<std::streamsize>(used));
+		flushed += used ;
+		used = 0 ;
+	}
+	return output.good() ;
+}
+//=================================================================================
+auto listwriter_t::close() ->bool {
+	auto rvalue = true ;
+	if (output.is_open()){
+		rvalue = flush();
+		output.close();
+	}
+	used = 0 ;
+	return rvalue ;
+}
+
+//=================================================================================
+auto listwriter_t::copy(std::istream &input, std::uint64_t count) ->bool {
+	while (count > 0){
+		if (used == buffer.size()){
+			flush();
+		}
+		auto amount = static_cast<std::size_t>(std::min<std::uint64_t>(count, buffer.size() - used)) ;
+		input.read(buffer.data() + used, static_cast<std::streamsize>(amount));
+		auto got = static_cast<std::size_t>(input.gcount()) ;
+		used += got ;
+		count -= got ;
+		if (got != amount){
+			return false ;
+		}
+	}
+	return true ;
+}
+
+//=================================================================================
+auto listwriter_t::operator<<(const std::string &value) ->listwriter_t& {
+	auto *start = reserve(value.size()) ;
+	std::memcpy(start, value.data(), value.size());
+	used += value.size() ;
+	return *this ;
+}
+//=================================================================================
+auto listwriter_t::operator<<(const char *value) ->listwriter_t& {
+	auto length = std::strlen(value) ;
+	auto *start = reserve(length) ;
+	std::memcpy(start, value, length);
+	used += length ;
+	return *this ;
+}
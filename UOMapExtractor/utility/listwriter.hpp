@@ -0,0 +1,96 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef listwriter_hpp
+#define listwriter_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <charconv>
+#include <type_traits>
+#include <algorithm>
+
+//=================================================================================
+// listwriter_t
+// Writer for the (very large) text command lists.  Everything is formatted
+// straight into one reusable buffer (numbers with std::to_chars), and the
+// buffer goes to the file in large writes.  Nothing is flushed per line, so
+// callers should use '\n' and not std::endl semantics.
+//=================================================================================
+class listwriter_t {
+	std::ofstream output ;
+	std::vector<char> buffer ;
+	std::size_t used ;
+	std::uint64_t flushed ;
+
+	// Make sure there is room for count more characters
+	auto reserve(std::size_t count) ->char* {
+		if (used + count > buffer.size()){
+			flush();
+			if (count > buffer.size()){
+				buffer.resize(count);
+			}
+		}
+		return buffer.data() + used ;
+	}
+
+public:
+	static constexpr std::size_t default_buffer = 4*1024*1024 ;
+
+	listwriter_t(std::size_t buffersize = default_buffer) ;
+	listwriter_t(const std::string &filepath, std::size_t buffersize = default_buffer) ;
+	~listwriter_t() ;
+
+	auto open(const std::string &filepath) ->bool ;
+	auto is_open() const ->bool ;
+	auto good() const ->bool ;
+	auto flush() ->bool ;
+	auto close() ->bool ;
+	// Characters written since open (before any newline translation, so the
+	// same count a text mode read of the file gives back)
+	auto written() const ->std::uint64_t {return flushed + used;}
+	// Copy count characters from input (the caller's previous output, say)
+	auto copy(std::istream &input, std::uint64_t count) ->bool ;
+
+	auto operator<<(const std::string &value) ->listwriter_t& ;
+	auto operator<<(const char *value) ->listwriter_t& ;
+	auto operator<<(char value) ->listwriter_t& {
+		*reserve(1) = value ;
+		++used ;
+		return *this ;
+	}
+
+	//==========================================================
+	// Decimal integers (char types are written as characters above,
+	// so cast an int8_t to int if the number is wanted)
+	template <typename T>
+	auto operator<<(T value) ->std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T,bool> && !std::is_same_v<T,char> && !std::is_same_v<T,signed char> && !std::is_same_v<T,unsigned char>,listwriter_t&> {
+		auto *start = reserve(24) ;
+		auto [pc,ec] = std::to_chars(start, start+24, value);
+		used += static_cast<std::size_t>(pc - start) ;
+		return *this ;
+	}
+
+	//==========================================================
+	// Hex with a 0x prefix, padded with leading 0 to at least digits
+	// (the same as strutil::ntos(value,radix_t::hex,true,digits))
+	template <typename T>
+	auto hex(T value, int digits = 0) ->listwriter_t& {
+		static_assert(std::is_integral_v<T>, "hex requires an integral value");
+		char number[24] ;
+		auto [pc,ec] = std::to_chars(number, number+sizeof(number), value, 16);
+		auto numchars = static_cast<int>(pc - number) ;
+		auto pad = std::max(digits - numchars,0) ;
+		auto *start = reserve(2 + pad + numchars) ;
+		start[0] = '0' ;
+		start[1] = 'x' ;
+		std::fill(start+2, start+2+pad, '0');
+		std::copy(number, pc, start+2+pad);
+		used += 2 + pad + numchars ;
+		return *this ;
+	}
+};
+
+#endif /* listwriter_hpp */
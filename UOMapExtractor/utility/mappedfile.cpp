@@ -0,0 +1,140 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "mappedfile.hpp"
+
+#include <utility>
+
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//=================================================================================
+mappedfile_t::mappedfile_t() :ptr(nullptr),length(0) {
+#if defined(_WIN32)
+	filehandle = INVALID_HANDLE_VALUE ;
+	maphandle = nullptr ;
+#else
+	descriptor = -1 ;
+#endif
+}
+//=================================================================================
+mappedfile_t::mappedfile_t(const std::string &filepath, access_t access) :mappedfile_t() {
+	open(filepath, access);
+}
+//=================================================================================
+mappedfile_t::mappedfile_t(mappedfile_t &&value) noexcept :mappedfile_t() {
+	*this = std::move(value) ;
+}
+//=================================================================================
+auto mappedfile_t::operator=(mappedfile_t &&value) noexcept ->mappedfile_t& {
+	if (this != &value){
+		close();
+		std::swap(ptr,value.ptr);
+		std::swap(length,value.length);
+#if defined(_WIN32)
+		std::swap(filehandle,value.filehandle);
+		std::swap(maphandle,value.maphandle);
+#else
+		std::swap(descriptor,value.descriptor);
+#endif
+	}
+	return *this ;
+}
+//=================================================================================
+mappedfile_t::~mappedfile_t() {
+	close();
+}
+
+//=================================================================================
+auto mappedfile_t::open(const std::string &filepath, access_t access) ->bool {
+	close();
+#if defined(_WIN32)
+	filehandle = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, (access == access_t::random) ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (filehandle == INVALID_HANDLE_VALUE){
+		return false ;
+	}
+	auto filesize = LARGE_INTEGER() ;
+	if (!GetFileSizeEx(filehandle, &filesize)){
+		close();
+		return false ;
+	}
+	length = static_cast<std::size_t>(filesize.QuadPart) ;
+	if (length > 0){
+		maphandle = CreateFileMappingA(filehandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (maphandle == nullptr){
+			close();
+			return false ;
+		}
+		ptr = static_cast<const std::uint8_t*>(MapViewOfFile(maphandle, FILE_MAP_READ, 0, 0, 0));
+		if (ptr == nullptr){
+			close();
+			return false ;
+		}
+	}
+#else
+	descriptor = ::open(filepath.c_str(), O_RDONLY);
+	if (descriptor < 0){
+		return false ;
+	}
+	struct stat status ;
+	if (fstat(descriptor, &status) != 0){
+		close();
+		return false ;
+	}
+	length = static_cast<std::size_t>(status.st_size) ;
+	if (length > 0){
+		auto mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (mapping == MAP_FAILED){
+			close();
+			return false ;
+		}
+		// Most of our files are walked front to back, so let the kernel read ahead
+		// (unless we were told it will be picked at)
+		madvise(mapping, length, (access == access_t::random) ? MADV_RANDOM : MADV_SEQUENTIAL);
+		ptr = static_cast<const std::uint8_t*>(mapping) ;
+	}
+#endif
+	return true ;
+}
+//=================================================================================
+auto mappedfile_t::close() ->void {
+#if defined(_WIN32)
+	if (ptr != nullptr){
+		UnmapViewOfFile(ptr);
+	}
+	if (maphandle != nullptr){
+		CloseHandle(maphandle);
+	}
+	if (filehandle != INVALID_HANDLE_VALUE){
+		CloseHandle(filehandle);
+	}
+	filehandle = INVALID_HANDLE_VALUE ;
+	maphandle = nullptr ;
+#else
+	if (ptr != nullptr){
+		munmap(const_cast<std::uint8_t*>(ptr), length);
+	}
+	if (descriptor >= 0){
+		::close(descriptor);
+	}
+	descriptor = -1 ;
+#endif
+	ptr = nullptr ;
+	length = 0 ;
+}
+//=================================================================================
+auto mappedfile_t::is_open() const ->bool {
+#if defined(_WIN32)
+	return filehandle != INVALID_HANDLE_VALUE ;
+#else
+	return descriptor >= 0 ;
+#endif
+}
@@ -0,0 +1,46 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef mappedfile_hpp
+#define mappedfile_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+//=================================================================================
+// mappedfile_t
+// A read only memory mapping of an entire file.  The data stays valid until the
+// object is closed or destroyed, so any pointers handed out from data() must
+// not outlive it.
+//=================================================================================
+class mappedfile_t {
+	const std::uint8_t *ptr ;
+	std::size_t length ;
+#if defined(_WIN32)
+	void *filehandle ;
+	void *maphandle ;
+#else
+	int descriptor ;
+#endif
+
+public:
+	// How the mapping will be read, a hint for the kernel's read ahead
+	enum class access_t { sequential, random };
+
+	mappedfile_t() ;
+	mappedfile_t(const std::string &filepath, access_t access = access_t::sequential) ;
+	mappedfile_t(const mappedfile_t&) = delete ;
+	auto operator=(const mappedfile_t&) ->mappedfile_t& = delete ;
+	mappedfile_t(mappedfile_t &&value) noexcept ;
+	auto operator=(mappedfile_t &&value) noexcept ->mappedfile_t& ;
+	~mappedfile_t() ;
+
+	auto open(const std::string &filepath, access_t access = access_t::sequential) ->bool ;
+	auto close() ->void ;
+	auto is_open() const ->bool ;
+
+	auto data() const ->const std::uint8_t* {return ptr;}
+	auto size() const ->std::size_t {return length;}
+};
+
+#endif /* mappedfile_hpp */
@@ -0,0 +1,62 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//=========================================================
+namespace parallel {
+	//=========================================================
+	auto threads() ->unsigned int {
+		return std::max(std::thread::hardware_concurrency(),1u);
+	}
+
+	//=========================================================
+	auto forEach(std::size_t count, unsigned int jobs, const std::function<void(std::size_t)> &work) ->void {
+		if (jobs == 0) {
+			jobs = threads();
+		}
+		jobs = static_cast<unsigned int>(std::min<std::size_t>(jobs,count)) ;
+		if (jobs <= 1) {
+			for (std::size_t index = 0 ; index < count ; ++index){
+				work(index);
+			}
+			return ;
+		}
+		auto next = std::atomic<std::size_t>(0) ;
+		auto failed = std::atomic<bool>(false) ;
+		auto error = std::exception_ptr() ;
+		auto errorlock = std::mutex() ;
+		auto worker = [&](){
+			for (auto index = next++ ; (index < count) && !failed ; index = next++){
+				try {
+					work(index);
+				}
+				catch(...){
+					auto lock = std::lock_guard<std::mutex>(errorlock);
+					if (!failed.exchange(true)){
+						error = std::current_exception() ;
+					}
+				}
+			}
+		};
+		auto pool = std::vector<std::thread>() ;
+		pool.reserve(jobs-1);
+		for (unsigned int i = 1 ; i < jobs ; ++i){
+			pool.emplace_back(worker);
+		}
+		// The calling thread does its share as well
+		worker();
+		for (auto &thread : pool){
+			thread.join();
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+}
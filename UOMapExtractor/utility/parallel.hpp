@@ -0,0 +1,24 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <cstddef>
+#include <functional>
+
+//=========================================================
+namespace parallel {
+	//=========================================================
+	// The number of hardware threads (at least 1)
+	auto threads() ->unsigned int ;
+
+	//=========================================================
+	// Run work(index) for every index in [0,count), on up to jobs
+	// threads (0 means one per hardware thread).  Indexes are handed
+	// out in order, so with one job this is just a for loop on the
+	// calling thread.  If any work throws, the remaining indexes are
+	// abandoned and the first exception is rethrown once all threads
+	// are joined.
+	auto forEach(std::size_t count, unsigned int jobs, const std::function<void(std::size_t)> &work) ->void ;
+}
+#endif /* parallel_hpp */
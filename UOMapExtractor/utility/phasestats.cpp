@@ -0,0 +1,60 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "phasestats.hpp"
+#include "procinfo.hpp"
+#include "strutil.hpp"
+
+//=========================================================
+phasestats_t::scope_t::scope_t(phasestats_t *stats, const std::string &name):stats(stats),outer(nullptr) {
+	if (stats != nullptr){
+		phase.name = name ;
+		phase.allocations = procinfo::allocations() ;
+		outer = stats->open ;
+		stats->open = &phase.counters ;
+		start = std::chrono::steady_clock::now() ;
+	}
+}
+//=========================================================
+phasestats_t::scope_t::~scope_t() {
+	end();
+}
+//=========================================================
+auto phasestats_t::scope_t::end() ->void {
+	if (stats != nullptr){
+		phase.milliseconds = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() - start).count() ;
+		phase.allocations = procinfo::allocations() - phase.allocations ;
+		phase.peakresident = procinfo::peakResident() ;
+		stats->open = outer ;
+		stats->recorded.push_back(std::move(phase));
+		stats = nullptr ;
+	}
+}
+
+//=========================================================
+auto phasestats_t::clear() ->void {
+	recorded.clear();
+	spare = counters_t() ;
+}
+//=========================================================
+auto phasestats_t::json(int mapnum) const ->std::string {
+	auto rvalue = strutil::format("{\"map\":%i,\"phases\":[",mapnum) ;
+	for (std::size_t index = 0 ; index < recorded.size() ; ++index){
+		const auto &phase = recorded[index] ;
+		if (index > 0){
+			rvalue += "," ;
+		}
+		// The names are our own, so there is nothing in them to escape
+		rvalue += strutil::format("{\"phase\":\"%s\",\"milliseconds\":%.3f,\"bytesRead\":%llu,\"bytesWritten\":%llu,\"entries\":%llu,\"blocks\":%llu,\"records\":%llu,",
+			phase.name.c_str(), phase.milliseconds,
+			static_cast<unsigned long long>(phase.counters.bytesread), static_cast<unsigned long long>(phase.counters.byteswritten),
+			static_cast<unsigned long long>(phase.counters.entries), static_cast<unsigned long long>(phase.counters.blocks),
+			static_cast<unsigned long long>(phase.counters.records)) ;
+		if (procinfo::countsAllocations()){
+			// Of the whole process, so it includes any maps running alongside
+			rvalue += strutil::format("\"processAllocations\":%llu,", static_cast<unsigned long long>(phase.allocations)) ;
+		}
+		rvalue += strutil::format("\"peakResident\":%llu}", static_cast<unsigned long long>(phase.peakresident)) ;
+	}
+	rvalue += "]}" ;
+	return rvalue ;
+}
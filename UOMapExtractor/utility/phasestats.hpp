@@ -0,0 +1,70 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef phasestats_hpp
+#define phasestats_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+
+/*
+ Where the time (and I/O) of a run goes.  A phase is timed by a scope_t, from
+ its construction to its destruction, and what it did is added up in
+ counters() as it goes (those of the innermost phase still open).  The
+ allocations are those of the whole process, every thread, during the phase
+ (only counted in a UOMAP_COUNT_ALLOCATIONS build, see procinfo.hpp), and the
+ peak the most it has had resident by its end, so when maps run at once they
+ include the others.
+ */
+//=========================================================
+class phasestats_t {
+public:
+	struct counters_t {
+		std::uint64_t bytesread = 0 ;
+		std::uint64_t byteswritten = 0 ;
+		std::uint64_t entries = 0 ;			// uop entries, or diff patches
+		std::uint64_t blocks = 0 ;			// map blocks
+		std::uint64_t records = 0 ;			// statics records
+	};
+	struct phase_t {
+		std::string name ;
+		double milliseconds = 0.0 ;
+		counters_t counters ;
+		std::uint64_t allocations = 0 ;
+		std::uint64_t peakresident = 0 ;	// bytes
+	};
+	//=========================================================
+	// Times a phase into stats, does nothing if stats is null
+	class scope_t {
+		phasestats_t *stats ;
+		phase_t phase ;
+		counters_t *outer ;
+		std::chrono::steady_clock::time_point start ;
+	public:
+		scope_t(phasestats_t *stats, const std::string &name) ;
+		~scope_t() ;
+		// Ends the phase before the scope does (the counters are no
+		// longer of use after)
+		auto end() ->void ;
+		scope_t(const scope_t&) = delete ;
+		auto operator=(const scope_t&) ->scope_t& = delete ;
+		auto counters() ->counters_t& {return phase.counters;}
+	};
+
+private:
+	std::vector<phase_t> recorded ;
+	counters_t *open = nullptr ;
+	counters_t spare ;			// Where counts go with no phase open
+
+public:
+	auto counters() ->counters_t& {return (open != nullptr) ? *open : spare;}
+	// In the order they ended (so a phase inside another is before it)
+	auto phases() const ->const std::vector<phase_t>& {return recorded;}
+	auto clear() ->void ;
+	// The phases as a JSON object, {"map":mapnum,"phases":[...]}.  The
+	// allocations are "processAllocations", and left out if not counted.
+	auto json(int mapnum) const ->std::string ;
+};
+
+#endif /* phasestats_hpp */
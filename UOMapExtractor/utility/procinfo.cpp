@@ -0,0 +1,147 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#include "procinfo.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#if defined(UOMAP_COUNT_ALLOCATIONS)
+//=========================================================
+// Allocations are counted by replacing the global operator new
+// and delete, every plain, array and nothrow form (sized
+// deletes included), so whichever one frees a block matches
+// the one that got it.  The aligned forms are left to the
+// library, as they are their own pair.  Nothing is counted
+// until countAllocations(true), so it costs a load of a flag
+// otherwise.  Constant initialised, so they are there before
+// any static constructor allocates.
+//=========================================================
+static auto allocationcount = std::atomic<std::uint64_t>(0) ;
+static auto counting = std::atomic<bool>(false) ;
+//=========================================================
+static auto allocate(std::size_t size) ->void* {
+	if (counting.load(std::memory_order_relaxed)){
+		allocationcount.fetch_add(1, std::memory_order_relaxed);
+	}
+	size = (size == 0) ? 1 : size ;
+	while (true){
+		auto *memory = std::malloc(size) ;
+		if (memory != nullptr){
+			return memory ;
+		}
+		auto handler = std::get_new_handler() ;
+		if (handler == nullptr){
+			throw std::bad_alloc() ;
+		}
+		handler();
+	}
+}
+//=========================================================
+static auto allocate(std::size_t size, const std::nothrow_t &) noexcept ->void* {
+	try {
+		return allocate(size) ;
+	}
+	catch (...){
+		return nullptr ;
+	}
+}
+//=========================================================
+auto operator new(std::size_t size) ->void* {
+	return allocate(size) ;
+}
+//=========================================================
+auto operator new[](std::size_t size) ->void* {
+	return allocate(size) ;
+}
+//=========================================================
+auto operator new(std::size_t size, const std::nothrow_t &tag) noexcept ->void* {
+	return allocate(size, tag) ;
+}
+//=========================================================
+auto operator new[](std::size_t size, const std::nothrow_t &tag) noexcept ->void* {
+	return allocate(size, tag) ;
+}
+//=========================================================
+auto operator delete(void *memory) noexcept ->void {
+	std::free(memory);
+}
+//=========================================================
+auto operator delete[](void *memory) noexcept ->void {
+	std::free(memory);
+}
+//=========================================================
+auto operator delete(void *memory, std::size_t) noexcept ->void {
+	std::free(memory);
+}
+//=========================================================
+auto operator delete[](void *memory, std::size_t) noexcept ->void {
+	std::free(memory);
+}
+//=========================================================
+auto operator delete(void *memory, const std::nothrow_t &) noexcept ->void {
+	std::free(memory);
+}
+//=========================================================
+auto operator delete[](void *memory, const std::nothrow_t &) noexcept ->void {
+	std::free(memory);
+}
+#endif
+
+//=========================================================
+namespace procinfo {
+	//=========================================================
+	auto peakResident() ->std::uint64_t {
+#if defined(_WIN32)
+		auto counters = PROCESS_MEMORY_COUNTERS() ;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))){
+			return static_cast<std::uint64_t>(counters.PeakWorkingSetSize) ;
+		}
+		return 0 ;
+#else
+		auto usage = rusage() ;
+		if (getrusage(RUSAGE_SELF, &usage) != 0){
+			return 0 ;
+		}
+#if defined(__APPLE__)
+		// Bytes on macOS, kilobytes everywhere else
+		return static_cast<std::uint64_t>(usage.ru_maxrss) ;
+#else
+		return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024 ;
+#endif
+#endif
+	}
+	//=========================================================
+	auto countsAllocations() ->bool {
+#if defined(UOMAP_COUNT_ALLOCATIONS)
+		return true ;
+#else
+		return false ;
+#endif
+	}
+	//=========================================================
+	auto allocations() ->std::uint64_t {
+#if defined(UOMAP_COUNT_ALLOCATIONS)
+		return allocationcount.load(std::memory_order_relaxed) ;
+#else
+		return 0 ;
+#endif
+	}
+	//=========================================================
+	auto countAllocations([[maybe_unused]] bool state) ->void {
+#if defined(UOMAP_COUNT_ALLOCATIONS)
+		counting.store(state, std::memory_order_relaxed);
+#endif
+	}
+}
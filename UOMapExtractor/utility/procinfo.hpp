@@ -0,0 +1,29 @@
+//Copyright © 2022 Charles Kerr. All rights reserved.
+
+#ifndef procinfo_hpp
+#define procinfo_hpp
+
+#include <cstdint>
+
+//=========================================================
+namespace procinfo {
+	//=========================================================
+	// The most memory this process has had resident so far, in
+	// bytes (0 if the platform won't say)
+	auto peakResident() ->std::uint64_t ;
+	//=========================================================
+	// Allocations are only counted in a build with
+	// UOMAP_COUNT_ALLOCATIONS defined, as that replaces the
+	// global operator new and delete for the whole program.
+	// Whether this build does.
+	auto countsAllocations() ->bool ;
+	//=========================================================
+	// The calls to operator new (array and nothrow forms
+	// included) this process has made while counting, from
+	// every thread (0 if the build doesn't count)
+	auto allocations() ->std::uint64_t ;
+	//=========================================================
+	// Starts (or stops) counting allocations, off by default
+	auto countAllocations(bool state) ->void ;
+}
+#endif /* procinfo_hpp */